@@ -15,6 +15,7 @@
 #include <sstream>  // string streams
 #include <string>
 #include <stdexcept>
+#include <random>
 #include <vector>
 
 #include "cgra_math.hpp"
@@ -22,10 +23,13 @@
 #include "opengl.hpp"
 #include "heightmap.hpp"
 #include "lsystem.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
 #include "tree.hpp"
 #include "treefactory.hpp"
 
 #include "flock.hpp"
+#include "flock_simulation.hpp"
 
 using namespace std;
 using namespace cgra;
@@ -58,19 +62,26 @@ GLuint snow_texture = 0;
 //
 int mapSize = 4;
 string treeFile = "res/trees/trees.txt";
-bool useOctTree = false;
+Separation separation = Separation::Naive;
 int num_boids = 200;
+int treeVariants = 4;
+uint64_t seed = random_device()();
+
+// Every random stream in the world is split off this one,
+// so a run can be repeated by passing the same --seed
+//
+rng::Generator worldRandom;
 
 // Base Heightmap to be rendered upon
 //
 hmap::Heightmap* heightmap;
 tree::TreeFactory* treeFactory;
-vector<tree::Tree*> trees;
+vector<tree::TreeInstance> trees;
 
 //Flock of birds
 //
 Flock* flock;
-Boid* boid;
+FlockSimulation* flockSimulation;
 
 //flags
 //
@@ -110,7 +121,7 @@ void scrollCallback(GLFWwindow* win, double xoffset, double yoffset) {
 }
 
 void step() {
-	flock->update(useOctTree);
+	flockSimulation->requestStep();
 }
 
 
@@ -122,9 +133,11 @@ void keyCallback(GLFWwindow* win, int key, int scancode, int action, int mods) {
 	// << "action=" << action << "mods=" << mods << endl;
 	if (key == 83 && action == 1) {
 		showOctTree = !showOctTree;
+		flock->setShowOctTree(showOctTree);
 	}
 	if (key == 68 && action == 1) {
 		debugMode = !debugMode;
+		flockSimulation->setPaused(debugMode);
 	}
 	if (key == 65 && action == 1) {
 		if (debugMode) {
@@ -132,13 +145,26 @@ void keyCallback(GLFWwindow* win, int key, int scancode, int action, int mods) {
 		}
 	}
 	if (key == 79 && action == 1) {
-		useOctTree = !useOctTree;
-		if (useOctTree) {
+		if (separation != Separation::OctTree) {
+			separation = Separation::OctTree;
 			cout << "Using oct tree" << endl;
 		}
 		else {
+			separation = Separation::Naive;
 			cout << "Not using oct tree" << endl;
 		}
+		flockSimulation->setSeparation(separation);
+	}
+	if (key == 71 && action == 1) {
+		if (separation != Separation::Grid) {
+			separation = Separation::Grid;
+			cout << "Using uniform grid" << endl;
+		}
+		else {
+			separation = Separation::Naive;
+			cout << "Not using uniform grid" << endl;
+		}
+		flockSimulation->setSeparation(separation);
 	}
 }
 
@@ -240,38 +266,50 @@ void initLights() {
 }
 
 void initHeightmap() {
-	heightmap = new hmap::Heightmap(mapSize);
+	heightmap = new hmap::Heightmap(mapSize, worldRandom.split(0));
 	heightmap->generateHeightmap();
 }
 
 void initTrees() {
-	treeFactory = new tree::TreeFactory(treeFile);
+	rng::Generator forestRandom = worldRandom.split(1);
+	treeFactory = new tree::TreeFactory(treeFile, treeVariants, forestRandom.split(0));
 
 	int incr = 8;
 	float halfIncr = incr / 2;
 	int halfSize = (heightmap->getSize() - (incr * 2)) / 2;
-	int y = halfSize;
 
-	for (int x = -halfSize; x <= halfSize; x += incr) {
-		// Randomly offset the trees
-		float offsetX = math::random(-halfIncr, halfIncr);
-		float offsetY = math::random(-halfIncr, halfIncr);
-		trees.push_back(treeFactory->generate(vec3(x + offsetX, -y + offsetY, 0)));
-		if (x == halfSize && y > -halfSize) {
-			y -= incr;
-			x = -halfSize - incr;
+	vector<ivec2> cells;
+	for (int y = halfSize; y >= -halfSize; y -= incr) {
+		for (int x = -halfSize; x <= halfSize; x += incr) {
+			cells.push_back(ivec2(x, y));
 		}
 	}
 
-	// Trees have been generated, so release the treeFactory object
-	// from memory and set its pointer to null
-	delete treeFactory;
-	treeFactory = nullptr;
+	// Place the trees across the worker pool. Each cell's random
+	// stream is keyed by its coordinates, so the forest is the same
+	// however the cells are scheduled.
+	rng::Generator cellsRandom = forestRandom.split(1);
+	trees.resize(cells.size());
+	ThreadPool::shared()->parallelFor(int(cells.size()), [&](int i) {
+		ivec2 cell = cells[i];
+		rng::Generator cellRandom = cellsRandom.split((uint64_t(uint32_t(cell.x)) << 32) | uint32_t(cell.y));
+
+		// Randomly offset the trees
+		float offsetX = cellRandom.uniform(-halfIncr, halfIncr);
+		float offsetY = cellRandom.uniform(-halfIncr, halfIncr);
+		trees[i] = treeFactory->generate(vec3(cell.x + offsetX, -cell.y + offsetY, 0), cellRandom);
+	});
+
+	// The treeFactory is kept alive, as it owns the meshes
+	// that every tree instance shares
 }
 
 void initFlock() {
-	flock = new Flock(num_boids);
-	boid = new Boid(vec3(1, 1, 1));
+	flock = new Flock(num_boids, worldRandom.split(2));
+
+	// The flock is stepped on its own thread, and only drawn here
+	flockSimulation = new FlockSimulation(flock);
+	flockSimulation->setSeparation(separation);
 }
 
 void groundMaterial() {
@@ -315,22 +353,16 @@ void renderObjects(int width, int height) {
 	glPopMatrix();
 
 	glPushMatrix();
-	for (tree::Tree* t : trees) {
-		t->render();
+	for (tree::TreeInstance& t : trees) {
+		t.render();
 	}
 	glPopMatrix();
 
 	boidMaterial();
-	if (!debugMode) {
-		flock->update(useOctTree);
-	}
-	else {
-		flock->render();
-	}
+	flockSimulation->render();
 	if (showOctTree) {
 		flock->showOctTree();
 	}
-	//boid->render();
 
 
 	glPopMatrix();
@@ -379,14 +411,24 @@ void APIENTRY debugCallbackARB(GLenum, GLenum, GLuint, GLenum, GLsizei, const GL
 // 
 int main(int argc, char** argv) {
 
-	// Initialize the GLFW library
-	if (!glfwInit()) {
-		cerr << "Error: Could not initialize GLFW" << endl;
-		abort(); // Unrecoverable error
+	// Separate out any flags, leaving the positional arguments
+	vector<string> args;
+	string compileFile = "";
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--compile" && i + 1 < argc) {
+			compileFile = argv[++i];
+		}
+		else if (arg == "--seed" && i + 1 < argc) {
+			seed = stoull(argv[++i]);
+		}
+		else {
+			args.push_back(arg);
+		}
 	}
 
-	if (argc >= 2) {
-		int tempSize = *argv[1] - '0';
+	if (args.size() >= 1) {
+		int tempSize = args[0][0] - '0';
 		if (0 > tempSize || tempSize > 6) {
 			cerr << "Error: Map Size " << tempSize << " is out of bounds (0 - 5)" << endl;
 			abort();
@@ -394,19 +436,35 @@ int main(int argc, char** argv) {
 		mapSize = tempSize;
 	}
 
-	if (argc == 3) {
-		treeFile = argv[2];
+	if (args.size() >= 2) {
+		treeFile = args[1];
 	}
-	else if (argc == 4) {
-		treeFile = argv[2];
-		string nBoids = argv[3];
-		num_boids = stoi(nBoids);
+	if (args.size() >= 3) {
+		num_boids = stoi(args[2]);
 	}
-	else if (argc == 5) {
-		treeFile = argv[2];
-		string nBoids = argv[3];
-		num_boids = stoi(nBoids);
-		useOctTree = argv[4];
+	if (args.size() >= 4) {
+		if (args[3] == "grid") {
+			separation = Separation::Grid;
+		}
+		else if (args[3] != "0") {
+			separation = Separation::OctTree;
+		}
+	}
+
+	// Compile the species file to the binary format and exit
+	if (compileFile != "") {
+		tree::TreeFactory::compile(treeFile, compileFile);
+		cout << "Compiled " << treeFile << " to " << compileFile << endl;
+		return 0;
+	}
+
+	worldRandom = rng::Generator(seed);
+	cout << "Using seed " << seed << endl;
+
+	// Initialize the GLFW library
+	if (!glfwInit()) {
+		cerr << "Error: Could not initialize GLFW" << endl;
+		abort(); // Unrecoverable error
 	}
 
 	// Get the version for GLFW for later
@@ -472,6 +530,9 @@ int main(int argc, char** argv) {
 	initTrees();
 	initLights();
 
+	// Start stepping the flock once the rest of the world is built
+	flockSimulation->start();
+
 	// Loop until the user closes the window
 	while (!glfwWindowShouldClose(g_window)) {
 
@@ -489,6 +550,8 @@ int main(int argc, char** argv) {
 		glfwPollEvents();
 	}
 
+	flockSimulation->stop();
+
 	glfwTerminate();
 }
 
@@ -4,68 +4,42 @@
 #include "cgra_math.hpp"
 #include "opengl.hpp"
 #include "boid.hpp"
+#include "flock.hpp"
 
 using namespace std;
 using namespace cgra;
 
-Boid::Boid(vec3 pos){
-	position = pos;
-	addTriangles();
-	createDisplayList();
-}
-
-void Boid::addTriangles(){
-	triangle tri;
-
-	tri.vertices[0] = vec3( 0.4f, 0.0f, 0.0f );
-	tri.vertices[1] = vec3( 0.0f, -0.2f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, 0.2f, 0.0f );
-
-	process(tri);
-
-	tri.vertices[0] = vec3( -0.4f, 0.0f, 0.0f );
-	tri.vertices[1] = vec3( 0.0f, -0.2f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, 0.2f, 0.0f );
-
-	process(tri);
-
-	tri.vertices[0] = vec3( 0.0f, 0.0f, 1.2f );
-	tri.vertices[1] = vec3( 0.4f, 0.0f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, 0.2f, 0.0f );
-
-	process(tri);
-
-	tri.vertices[0] = vec3( 0.0f, 0.0f, 1.2f );
-	tri.vertices[1] = vec3( -0.4f, 0.0f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, 0.2f, 0.0f );
-
-	process(tri);
+GLuint Boid::m_displayList = 0;
 
-	tri.vertices[0] = vec3( 0.0f, 0.0f, 1.2f );
-	tri.vertices[1] = vec3( 0.4f, 0.0f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, -0.2f, 0.0f );
+Boid::Boid(){}
 
-	process(tri);
-
-	tri.vertices[0] = vec3( 0.0f, 0.0f, 1.2f );
-	tri.vertices[1] = vec3( -0.4f, 0.0f, 0.0f );
-	tri.vertices[2] = vec3( 0.0f, -0.2f, 0.0f );
+Boid::Boid(const Flock *f, int i){
+	flock = f;
+	index = i;
+}
 
-	process(tri);
+vec3 Boid::position() const{
+	return flock->getPosition(index);
 }
 
-void Boid::process(triangle tri){
-	vec3 v1 = tri.vertices[0] - tri.vertices[1];
-	vec3 v2 = tri.vertices[0] - tri.vertices[2];
-		
-	tri.normal = cross(v1, v2);
+vec3 Boid::velocity() const{
+	return flock->getVelocity(index);
+}
 
-	triangles.push_back(tri);
+float Boid::minimumSeparation() const{
+	return flock->getMinimumSeparation();
 }
+
 void Boid::createDisplayList()
 {
-	// Delete old list if there is one
-	if (m_displayList) glDeleteLists(m_displayList, 1);
+	vec3 triangles[6][3] = {
+		{ vec3( 0.4f, 0.0f, 0.0f ), vec3( 0.0f, -0.2f, 0.0f ), vec3( 0.0f, 0.2f, 0.0f ) },
+		{ vec3( -0.4f, 0.0f, 0.0f ), vec3( 0.0f, -0.2f, 0.0f ), vec3( 0.0f, 0.2f, 0.0f ) },
+		{ vec3( 0.0f, 0.0f, 1.2f ), vec3( 0.4f, 0.0f, 0.0f ), vec3( 0.0f, 0.2f, 0.0f ) },
+		{ vec3( 0.0f, 0.0f, 1.2f ), vec3( -0.4f, 0.0f, 0.0f ), vec3( 0.0f, 0.2f, 0.0f ) },
+		{ vec3( 0.0f, 0.0f, 1.2f ), vec3( 0.4f, 0.0f, 0.0f ), vec3( 0.0f, -0.2f, 0.0f ) },
+		{ vec3( 0.0f, 0.0f, 1.2f ), vec3( -0.4f, 0.0f, 0.0f ), vec3( 0.0f, -0.2f, 0.0f ) }
+	};
 
 	// Create a new list
 	m_displayList = glGenLists(1);
@@ -73,16 +47,15 @@ void Boid::createDisplayList()
 
 	glBegin(GL_TRIANGLES);
 
-	for(int i = 0; i < triangles.size(); ++i){
-		glVertex3f(triangles[i].vertices[0].x, triangles[i].vertices[0].y, triangles[i].vertices[0].z);
-		glNormal3f(triangles[i].normal.x, triangles[i].normal.y, triangles[i].normal.z);
-
-		glVertex3f(triangles[i].vertices[1].x, triangles[i].vertices[1].y, triangles[i].vertices[1].z);
-		glNormal3f(triangles[i].normal.x, triangles[i].normal.y, triangles[i].normal.z);
-
-		glVertex3f(triangles[i].vertices[2].x, triangles[i].vertices[2].y, triangles[i].vertices[2].z);
-		glNormal3f(triangles[i].normal.x, triangles[i].normal.y, triangles[i].normal.z);
+	for(int i = 0; i < 6; ++i){
+		vec3 v1 = triangles[i][0] - triangles[i][1];
+		vec3 v2 = triangles[i][0] - triangles[i][2];
+		vec3 normal = cross(v1, v2);
 
+		for(int j = 0; j < 3; ++j){
+			glNormal3f(normal.x, normal.y, normal.z);
+			glVertex3f(triangles[i][j].x, triangles[i][j].y, triangles[i][j].z);
+		}
 	}
 
 	glEnd();
@@ -90,15 +63,22 @@ void Boid::createDisplayList()
 	glEndList();
 }
 
-void Boid::render(){
+void Boid::render(vec3 position, vec3 velocity){
+	if(!m_displayList){
+		createDisplayList();
+	}
+
 	glPushMatrix();
 
 	glTranslatef(position.x, position.y, position.z);
 
-	vec3 axis = cross(normalize(velocity), vec3(0, 0, 1));
-	float d = dot(normalize(velocity), vec3(0, 0, 1));
-	float th = -degrees(acos(d));
-	glRotatef(th, axis.x, axis.y, axis.z);
+	//A boid that is not moving has no heading, so leave it unrotated
+	if(dot(velocity, velocity) > 0){
+		vec3 axis = cross(normalize(velocity), vec3(0, 0, 1));
+		float d = dot(normalize(velocity), vec3(0, 0, 1));
+		float th = -degrees(acos(d));
+		glRotatef(th, axis.x, axis.y, axis.z);
+	}
 	
 	glShadeModel(GL_SMOOTH);
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -106,4 +86,4 @@ void Boid::render(){
 	glCallList(m_displayList);
 	
 	glPopMatrix();
-}
\ No newline at end of file
+}
@@ -1,40 +1,32 @@
+#pragma once
+
 #include "cgra_math.hpp"
 #include "opengl.hpp"
 
 using namespace std;
 using namespace cgra;
 
+class Flock;
 
-struct triangle{
-	vec3 vertices[3];
-
-	cgra::vec3 normal;
-};
-
+// A view of one boid in a Flock. The simulation state lives in the
+// flock's arrays, so a Boid is just the flock and an index into them.
 class Boid{
 private:
-	vector<triangle> triangles;
-
-	GLuint m_displayList = 0;
+	// Every boid has the same shape, so they share one display list
+	static GLuint m_displayList;
 
-	void addTriangles();
-	void createDisplayList();
-	void process(triangle tri);
+	static void createDisplayList();
 
 public:
-	cgra::vec3 position;
-	cgra::vec3 velocity;
-	cgra::vec3 destination;
-
-	int o_neighbours = 0;
-	cgra::vec3 o_velocity = vec3(0, 0, 0);
+	const Flock *flock = nullptr;
+	int index = 0;
 
-	Boid* left = nullptr;
-	Boid* right = nullptr;
-	Boid* parent = nullptr;
+	Boid();
+	Boid(const Flock *f, int i);
 
-	float minimum_separation = 0.7f;
+	cgra::vec3 position() const;
+	cgra::vec3 velocity() const;
+	float minimumSeparation() const;
 
-	Boid(cgra::vec3 position);
-	void render();
+	static void render(cgra::vec3 position, cgra::vec3 velocity);
 };
@@ -1,69 +1,150 @@
 #include <cmath>
-#include <cstdlib>
 
 #include "cgra_math.hpp"
 #include "flock.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
 
 using namespace std;
 using namespace cgra;
 
-Flock::Flock(int size){
-	for (int i = 0; i < size - 1; ++i){
-		Boid *b = new Boid(vec3(rand() % 10, rand() % 10, rand() % 10));
-		boids.push_back(b);
-		arrange(leader, b);
+Flock::Flock(int size, rng::Generator r){
+	random = r;
+	count = max(size, 1);
+
+	positions.resize(count);
+	velocities.resize(count);
+	destinations.resize(count);
+	separations.resize(count);
+	oct_velocities.resize(count);
+	oct_neighbours.resize(count, 0);
+	parents.resize(count, -1);
+	left_children.resize(count, -1);
+	right_children.resize(count, -1);
+
+	for (int i = 1; i < count; ++i){
+		int x = random.below(10);
+		int y = random.below(10);
+		int z = random.below(10);
+		positions.set(i, vec3(x, y, z));
+		arrange(0, i);
+		followers.push_back(Boid(this, i));
 	}
-	oct_tree = new OctTree(vec3(-50, -50, -50), vec3(100, 100, 100), boids);
+	previous_positions = positions;
 } 
 
-void Flock::update(bool useTree){
-	use_tree = useTree;
+Flock::~Flock(){
+	delete oct_tree;
+}
+
+void Flock::update(Separation mode, ThreadPool *pool){
+	separation = mode;
+
+	rebuildOctTree();
+
+	previous_positions = positions;
+
+	if(separation == Separation::Grid){
+		buildGrid();
+	}
 
-	leader->destination = destination;
-	steer(leader);
+	//Separation only reads the start of step positions and each boid
+	//only writes its own entry, so ranges of boids can be handed out
+	//to any thread and the result is the same
+	pool->parallelFor(count, 256, [this](int begin, int end){
+		for(int i = begin; i < end; ++i){
+			if(separation == Separation::Naive){
+				separations.set(i, separate(i));
+			}
+			else if(separation == Separation::Grid){
+				separations.set(i, gridSeparate(i));
+			}
+			else{
+				separations.set(i, vec3(0, 0, 0));
+			}
+		}
+	});
+
+	SteerKernel steer = steerKernel();
+	SteerData data = steerData();
+
+	destinations.set(0, destination);
+	steer(data, 0, 1);
 	checkChangeDest();
-	leader->render();
 
-	if(use_tree){
+	if(separation == Separation::OctTree){
 		octSeparate();
 	}
-	int s = boids.size();
-	for(int i = 0; i < s; ++i){
-		boids[i]->destination = boids[i]->parent->position;
-		steer(boids[i]);
-		boids[i]->render();
-	}
 
-	delete oct_tree;
-	oct_tree = nullptr;
+	//Followers chase where their parent was, so they can all be
+	//steered at once. Ranges are a multiple of 8 boids so the SIMD
+	//kernels only fall back to scalar code at the very end.
+	pool->parallelFor(count - 1, 4096, [&](int begin, int end){
+		for(int i = begin + 1; i <= end; ++i){
+			destinations.set(i, previous_positions.get(parents[i]));
+		}
+		steer(data, begin + 1, end + 1);
+	});
 
-	oct_tree = new OctTree(vec3(-50, -50, -50), vec3(100, 100, 100), boids);
 }
 
-void Flock::steer(Boid *b){
-	vec3 v = vec3(0, 0, 0);
-	v += align(b) * 0.015;
-	if(!use_tree){
-		v += separate(b);
+/*Replace the oct tree with one over the current positions. Building it
+costs more than the rest of a step, so it is only kept while it is used
+for separation or drawn.*/
+void Flock::rebuildOctTree(){
+	//Build the new tree before taking the lock, so drawing the old
+	//one is only held up by the swap
+	OctTree *next = nullptr;
+	if(separation == Separation::OctTree || show_oct_tree){
+		next = new OctTree(vec3(-50, -50, -50), vec3(100, 100, 100), followers);
 	}
 
-	b->velocity += v;
-
-	float length = lengthVector(b->velocity);
-	if(length > max_speed){
-		b->velocity = b->velocity*(max_speed/length);
+	OctTree *old = nullptr;
+	{
+		lock_guard<mutex> lock(oct_tree_mutex);
+		old = oct_tree;
+		oct_tree = next;
 	}
+	delete old;
+}
+
+void Flock::setShowOctTree(bool show){
+	show_oct_tree = show;
+}
 
-	b->position += b->velocity;
+void Flock::snapshot(FlockSnapshot &out) const{
+	out.count = count;
+	out.previous_positions = previous_positions;
+	out.positions = positions;
+	out.velocities = velocities;
+}
+
+SteerData Flock::steerData(){
+	SteerData data;
+	data.position_x = positions.x.data();
+	data.position_y = positions.y.data();
+	data.position_z = positions.z.data();
+	data.velocity_x = velocities.x.data();
+	data.velocity_y = velocities.y.data();
+	data.velocity_z = velocities.z.data();
+	data.destination_x = destinations.x.data();
+	data.destination_y = destinations.y.data();
+	data.destination_z = destinations.z.data();
+	data.separation_x = separations.x.data();
+	data.separation_y = separations.y.data();
+	data.separation_z = separations.z.data();
+	data.align_weight = 0.015f;
+	data.max_speed = max_speed;
+	return data;
 }
 
 void Flock::checkChangeDest(){
-	vec3 v = leader->position - destination;
+	vec3 v = positions.get(0) - destination;
 	if(lengthVector(v) < 5){
-		int x = rand() % 20;
-		int z = rand() % 20;
-		if(rand() % 2){x *= -1;}
-		if(rand() % 2){z *= -1;}
+		int x = random.below(20);
+		int z = random.below(20);
+		if(random.below(2)){x *= -1;}
+		if(random.below(2)){z *= -1;}
 		destination = vec3(x, 12, z);
 	}
 }
@@ -90,21 +171,16 @@ vec3 Flock::normalizeVector(vec3 v){
 	return vec3(0, 0, 0);
 }
 
-vec3 Flock::align(Boid *b){
-	vec3 a = b->destination - b->position;
-	return normalizeVector(a);
-}
-
-vec3 Flock::separate(Boid *b){
+vec3 Flock::separate(int b){
 	int neighbours = 0;
 	vec3 velocity = vec3(0, 0, 0);
 
-	int s = boids.size();
-	for(int i = 0; i < s-1; ++i){
-		if(boids[i] != b){
-			float distance = lengthVector(b->position - boids[i]->position);
-			if(distance < b->minimum_separation){
-				vec3 force = b->position - boids[i]->position;
+	vec3 position = previous_positions.get(b);
+	for(int i = 1; i < count; ++i){
+		if(i != b){
+			float distance = lengthVector(position - previous_positions.get(i));
+			if(distance < minimum_separation){
+				vec3 force = position - previous_positions.get(i);
 				velocity += normalizeVector(force);
 
 				++neighbours;
@@ -122,58 +198,161 @@ vec3 Flock::separate(Boid *b){
 }
 
 void Flock::octSeparate(){
-	vector<Boid*> obsList;
+	vector<Boid> obsList;
 	vector<hitRecord> collisions = oct_tree->findCollisions(obsList);
 
 	for(hitRecord hr : collisions){
-		hr.boid->o_velocity += normalizeVector(hr.force);
-		hr.boid->o_neighbours++;
+		int b = hr.boid.index;
+		oct_velocities.set(b, oct_velocities.get(b) + normalizeVector(hr.force));
+		oct_neighbours[b]++;
 	}
 
 	for(hitRecord hr : collisions){
-		if(hr.boid->o_neighbours > 0){
-			if(hr.boid->o_velocity.x != 0){hr.boid->o_velocity.x /= hr.boid->o_neighbours;}
-			if(hr.boid->o_velocity.y != 0){hr.boid->o_velocity.y /= hr.boid->o_neighbours;}
-			if(hr.boid->o_velocity.z != 0){hr.boid->o_velocity.z /= hr.boid->o_neighbours;}
+		int b = hr.boid.index;
+		vec3 o_velocity = oct_velocities.get(b);
+		if(oct_neighbours[b] > 0){
+			if(o_velocity.x != 0){o_velocity.x /= oct_neighbours[b];}
+			if(o_velocity.y != 0){o_velocity.y /= oct_neighbours[b];}
+			if(o_velocity.z != 0){o_velocity.z /= oct_neighbours[b];}
+			oct_velocities.set(b, o_velocity);
 		}
-		hr.boid->velocity += hr.boid->o_velocity;
+		velocities.set(b, velocities.get(b) + o_velocity);
 	}
 }
 
+/*Counting sort every follower into a uniform grid over the flock's bounds*/
+void Flock::buildGrid(){
+	vec3 lower = previous_positions.get(0);
+	vec3 upper = previous_positions.get(0);
+	for(int i = 1; i < count; ++i){
+		lower = cgra::min(lower, previous_positions.get(i));
+		upper = cgra::max(upper, previous_positions.get(i));
+	}
+
+	//Cells at least as wide as the separation distance keep every
+	//neighbour within the adjacent cells
+	cell_size = minimum_separation;
+
+	//A very spread out flock would need a huge mostly empty grid, so use
+	//bigger cells once there would be many more cells than boids
+	vec3 extent = upper - lower;
+	float max_cells = max(8.0f * count, 4096.0f);
+	float cells = (extent.x / cell_size + 1) * (extent.y / cell_size + 1) * (extent.z / cell_size + 1);
+	if(cells > max_cells){
+		cell_size *= cbrt(cells / max_cells);
+	}
+
+	grid_origin = lower;
+	grid_size = ivec3(int(extent.x / cell_size) + 1, int(extent.y / cell_size) + 1, int(extent.z / cell_size) + 1);
+
+	//Count the boids in each cell, offset by one so the prefix sum
+	//leaves the first index of every cell in cell_start
+	cell_start.assign(grid_size.x * grid_size.y * grid_size.z + 1, 0);
+	boid_cells.resize(count);
+	for(int i = 1; i < count; ++i){
+		ivec3 c = gridCell(previous_positions.get(i));
+		boid_cells[i] = (c.z * grid_size.y + c.y) * grid_size.x + c.x;
+		cell_start[boid_cells[i] + 1]++;
+	}
+
+	int cell_count = cell_start.size();
+	for(int i = 1; i < cell_count; ++i){
+		cell_start[i] += cell_start[i - 1];
+	}
+
+	//Scatter the boids into their cells' ranges
+	vector<int> next(cell_start.begin(), cell_start.end() - 1);
+	cell_boids.resize(count - 1);
+	for(int i = 1; i < count; ++i){
+		cell_boids[next[boid_cells[i]]++] = i;
+	}
+}
+
+ivec3 Flock::gridCell(vec3 position){
+	vec3 p = floor((position - grid_origin) / cell_size);
+	return cgra::clamp(ivec3(p), ivec3(0, 0, 0), grid_size - ivec3(1, 1, 1));
+}
+
+/*Same as separate, but only checks boids in the 27 cells around b*/
+vec3 Flock::gridSeparate(int b){
+	int neighbours = 0;
+	vec3 velocity = vec3(0, 0, 0);
+
+	vec3 position = previous_positions.get(b);
+	ivec3 c = gridCell(position);
+	for(int z = max(c.z - 1, 0); z <= min(c.z + 1, grid_size.z - 1); ++z){
+		for(int y = max(c.y - 1, 0); y <= min(c.y + 1, grid_size.y - 1); ++y){
+			for(int x = max(c.x - 1, 0); x <= min(c.x + 1, grid_size.x - 1); ++x){
+				int cell = (z * grid_size.y + y) * grid_size.x + x;
+
+				for(int i = cell_start[cell]; i < cell_start[cell + 1]; ++i){
+					int other = cell_boids[i];
+					if(other != b){
+						float distance = lengthVector(position - previous_positions.get(other));
+						if(distance < minimum_separation){
+							vec3 force = position - previous_positions.get(other);
+							velocity += normalizeVector(force);
+
+							++neighbours;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	if(neighbours > 0){
+		if(velocity.x != 0){velocity.x /= neighbours;}
+		if(velocity.y != 0){velocity.y /= neighbours;}
+		if(velocity.z != 0){velocity.z /= neighbours;}
+	}
+	return velocity;
+}
+
 void Flock::setDestination(vec3 dest){
 	destination = dest;
 }
 
-void Flock::arrange(Boid *node, Boid *b){
-	if(node->left == nullptr){
-		node->left = b;
-		b->parent = node;
+void Flock::arrange(int node, int b){
+	if(left_children[node] < 0){
+		left_children[node] = b;
+		parents[b] = node;
 		return;
 	}
-	else if(node->right == nullptr){
-		node->right = b;
-		b->parent = node;
+	else if(right_children[node] < 0){
+		right_children[node] = b;
+		parents[b] = node;
 		return;
 	}
 	else{
-		if(rand()%2){
-			arrange(node->left, b);
+		if(random.below(2)){
+			arrange(left_children[node], b);
 		}
 		else{
-			arrange(node->right, b);
+			arrange(right_children[node], b);
 		}
 	}
 }
 
-void Flock::render(){
-	leader->render();
-
-	int s = boids.size();
-	for(int i = 0; i < s; ++i){
-		boids[i]->render();
+void Flock::showOctTree(){
+	lock_guard<mutex> lock(oct_tree_mutex);
+	if(oct_tree != nullptr){
+		oct_tree->renderTree(0);
 	}
 }
 
-void Flock::showOctTree(){
-	oct_tree->renderTree(0);
+int Flock::getSize() const{
+	return count;
+}
+
+vec3 Flock::getPosition(int b) const{
+	return positions.get(b);
+}
+
+vec3 Flock::getVelocity(int b) const{
+	return velocities.get(b);
+}
+
+float Flock::getMinimumSeparation() const{
+	return minimum_separation;
 }
@@ -1,35 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
 #include "cgra_math.hpp"
 #include "opengl.hpp"
 #include "oct_tree.hpp"
+#include "rng.hpp"
+#include "steer_kernel.hpp"
+#include "thread_pool.hpp"
 
 using namespace std;
 using namespace cgra;
 
+// How each boid finds the neighbours it keeps its distance from
+enum class Separation{
+	Naive,		// check every other boid
+	OctTree,	// collisions found by walking an oct tree
+	Grid		// check the surrounding cells of a uniform grid
+};
+
+// One vec3 per boid, stored as three contiguous float arrays
+struct Vec3Array{
+	vector<float> x;
+	vector<float> y;
+	vector<float> z;
+
+	void resize(int n, float value = 0.0f){
+		x.resize(n, value);
+		y.resize(n, value);
+		z.resize(n, value);
+	}
+
+	vec3 get(int i) const{
+		return vec3(x[i], y[i], z[i]);
+	}
+
+	void set(int i, vec3 v){
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+};
+
+// Copy of the flock's state after one step, handed from the
+// simulation thread to the render thread
+struct FlockSnapshot{
+	int count = 0;
+	Vec3Array previous_positions;
+	Vec3Array positions;
+	Vec3Array velocities;
+};
+
 class Flock{
 private:
 
+	// The oct tree is rebuilt by whichever thread steps the flock, so
+	// swapping it for the new one and drawing it both take this lock.
+	// It is only built for oct tree separation or while it is shown.
 	OctTree *oct_tree = nullptr;
-	bool use_tree = false;
+	mutable mutex oct_tree_mutex;
+	atomic<bool> show_oct_tree{false};
+	Separation separation = Separation::Naive;
+
+	// Uniform grid of boid indices, rebuilt every step. Boids are
+	// counting sorted by cell, so the boids in cell c are
+	// cell_boids[cell_start[c]] to cell_boids[cell_start[c + 1] - 1].
+	vec3 grid_origin;
+	ivec3 grid_size;
+	float cell_size = 1.0f;
+	vector<int> cell_start;
+	vector<int> cell_boids;
+	vector<int> boid_cells;
+
+	// Simulation state, one entry per boid. Boid 0 is the leader,
+	// and every other boid follows its parent.
+	int count = 0;
+	Vec3Array positions;
+	Vec3Array velocities;
+	Vec3Array destinations;
+	Vec3Array separations;
+	vector<int> parents;
+	vector<int> left_children;
+	vector<int> right_children;
+
+	// Positions at the start of the step. Everything a boid steers
+	// by is read from here, so the whole flock can move at once.
+	Vec3Array previous_positions;
+
+	// Separation accumulated from oct tree collisions
+	Vec3Array oct_velocities;
+	vector<int> oct_neighbours;
+
+	// Views of the followers, which are what the oct tree holds
+	vector<Boid> followers;
 
-	Boid *leader = new Boid(vec3(0, 0, 0));
 	vec3 destination = vec3(15, 15, 15);
-	vector<Boid*> boids;
 
 	float max_speed = 0.2f;
+	float minimum_separation = 0.7f;
 
-	void steer(Boid *b);
+	rng::Generator random;
+
+	SteerData steerData();
 	float lengthVector(cgra::vec3 v);
 	cgra::vec3 normalizeVector(cgra::vec3 v);
-	cgra::vec3 separate(Boid *b);
+	cgra::vec3 separate(int b);
 	void octSeparate();
-	cgra::vec3 align(Boid *b);
+	void rebuildOctTree();
+	void buildGrid();
+	cgra::ivec3 gridCell(cgra::vec3 position);
+	cgra::vec3 gridSeparate(int b);
 	void checkChangeDest();
 	
-	void arrange(Boid *node, Boid *b);
+	void arrange(int node, int b);
 public:
-	Flock(int size);
+	Flock(int size, rng::Generator random);
+	~Flock();
 	void setDestination(vec3 dest);
-	void update(bool useTree);
+	// Steps the flock, spreading the work over pool. The result is the
+	// same whatever size the pool is.
+	void update(Separation mode, ThreadPool *pool = ThreadPool::shared());
+	void snapshot(FlockSnapshot &out) const;
+	void setShowOctTree(bool show);
 	void showOctTree();
-	void render();
+
+	int getSize() const;
+	cgra::vec3 getPosition(int b) const;
+	cgra::vec3 getVelocity(int b) const;
+	float getMinimumSeparation() const;
 };
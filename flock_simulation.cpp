@@ -0,0 +1,120 @@
+#include "cgra_math.hpp"
+#include "boid.hpp"
+#include "flock_simulation.hpp"
+
+using namespace std;
+using namespace cgra;
+
+const int FlockSimulation::fresh_flag;
+const int FlockSimulation::rate;
+
+FlockSimulation::FlockSimulation(Flock *f){
+	flock = f;
+
+	//Start with every buffer holding the initial state, so there is
+	//something to draw before the first step
+	for(Snapshot &s : snapshots){
+		flock->snapshot(s.flock);
+		s.time = clock::now();
+	}
+}
+
+FlockSimulation::~FlockSimulation(){
+	stop();
+}
+
+void FlockSimulation::start(){
+	if(running.exchange(true)){
+		return;
+	}
+	worker = thread([this]{ run(); });
+}
+
+void FlockSimulation::stop(){
+	running = false;
+	if(worker.joinable()){
+		worker.join();
+	}
+}
+
+void FlockSimulation::setSeparation(Separation mode){
+	separation = int(mode);
+}
+
+void FlockSimulation::setPaused(bool pause){
+	paused = pause;
+}
+
+void FlockSimulation::requestStep(){
+	pending_steps++;
+}
+
+void FlockSimulation::run(){
+	const clock::duration timestep = chrono::duration_cast<clock::duration>(chrono::seconds(1)) / rate;
+
+	//Catching up on more than this many steps at once would only make
+	//the stall worse, so past it the simulation just falls behind
+	const clock::duration max_lag = timestep * 8;
+
+	clock::time_point next = clock::now();
+	while(running){
+		if(paused){
+			if(pending_steps > 0){
+				pending_steps--;
+				step();
+			}
+			else{
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+			next = clock::now();
+			continue;
+		}
+
+		step();
+
+		next += timestep;
+		clock::time_point now = clock::now();
+		if(now - next > max_lag){
+			next = now;
+		}
+		this_thread::sleep_until(next);
+	}
+}
+
+void FlockSimulation::step(){
+	flock->update(Separation(separation.load()));
+	publish();
+}
+
+void FlockSimulation::publish(){
+	Snapshot &s = snapshots[back];
+	flock->snapshot(s.flock);
+	s.time = clock::now();
+
+	//Swap the filled buffer in as the newest, and take whichever one
+	//it replaces to fill next time
+	back = ready.exchange(back | fresh_flag) & ~fresh_flag;
+}
+
+void FlockSimulation::render(){
+	if(ready.load() & fresh_flag){
+		front = ready.exchange(front) & ~fresh_flag;
+	}
+
+	const Snapshot &s = snapshots[front];
+	const FlockSnapshot &f = s.flock;
+
+	//Draw one step behind the simulation, moving from the previous
+	//positions to the newest over the time the next step takes.
+	//A paused flock is shown exactly where it stopped.
+	float alpha = 1.0f;
+	if(!paused){
+		chrono::duration<float> elapsed = clock::now() - s.time;
+		alpha = min(elapsed.count() * rate, 1.0f);
+	}
+
+	for(int i = 0; i < f.count; ++i){
+		vec3 position = mix(f.previous_positions.get(i), f.positions.get(i), alpha);
+		Boid::render(position, f.velocities.get(i));
+	}
+}
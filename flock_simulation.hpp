@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "flock.hpp"
+
+using namespace std;
+
+// Steps a flock on its own thread at a fixed rate, independent of the
+// frame rate. After every step the flock is copied into one of three
+// snapshot buffers: the simulation fills one, the renderer reads
+// another, and the third holds the newest finished snapshot, so
+// neither thread ever waits on the other.
+class FlockSimulation{
+private:
+	typedef chrono::steady_clock clock;
+
+	struct Snapshot{
+		FlockSnapshot flock;
+		clock::time_point time;
+	};
+
+	Flock *flock;
+	thread worker;
+
+	atomic<bool> running{false};
+	atomic<bool> paused{false};
+	atomic<int> pending_steps{0};
+	atomic<int> separation{int(Separation::Naive)};
+
+	// Index of the newest snapshot, with fresh_flag set while the
+	// renderer has not picked it up yet
+	static const int fresh_flag = 4;
+	Snapshot snapshots[3];
+	atomic<int> ready{0};
+	int back = 1;
+	int front = 2;
+
+	void run();
+	void step();
+	void publish();
+public:
+	// Simulation steps per second
+	static const int rate = 120;
+
+	FlockSimulation(Flock *f);
+	~FlockSimulation();
+
+	void start();
+	void stop();
+
+	void setSeparation(Separation mode);
+
+	// While paused the flock only moves when a step is requested
+	void setPaused(bool pause);
+	void requestStep();
+
+	// Draws the newest snapshot, interpolated from the step before it
+	// by how far the simulation is through the next step
+	void render();
+};
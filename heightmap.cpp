@@ -2,26 +2,24 @@
 #include <iostream> // input/output streams
 #include <fstream>  // file streams
 #include <sstream>  // string streams
+#include <memory>
 #include <string>
 #include <stdexcept>
 #include <vector>
-#include <random>
 
 #include "cgra_math.hpp"
 #include "opengl.hpp"
 #include "heightmap.hpp"
+#include "rng.hpp"
 
 using namespace cgra;
 using namespace hmap;
 using namespace std;
 
-Heightmap::Heightmap() {
-	// Default the size to 5 if one is not provided
-	size = 5;
-	constructHelper();
-}
-
-Heightmap::Heightmap(int mapSize) {
+// The terrain is drawn entirely from r, so there is no constructor
+// without one that could quietly ignore the world seed
+Heightmap::Heightmap(int mapSize, rng::Generator r) {
+	random = r;
 	int counter = 1;
 	int newSize = 5;
 	while(counter < mapSize) {
@@ -32,24 +30,22 @@ Heightmap::Heightmap(int mapSize) {
 	constructHelper();
 }
 
-Heightmap::Heightmap(int mapSize, float mapSeed) {
-	size = mapSize;
-	seed = mapSeed;
-	constructHelper();
-}
-
 Heightmap::~Heightmap() {  }
 
 int Heightmap::getSize() {
 	return size;
 }
 
-vector<vec3> Heightmap::getVertices() {
-	return vertices;
+const vector<vec3>& Heightmap::getVertices() const {
+	return mesh->vertices;
 }
 
-vector<Triangle> Heightmap::getTriangles() {
-	return triangles;
+const vector<Triangle>& Heightmap::getTriangles() const {
+	return mesh->triangles;
+}
+
+shared_ptr<const Mesh> Heightmap::getMesh() const {
+	return mesh;
 }
 
 void Heightmap::constructHelper() {
@@ -133,55 +129,65 @@ void Heightmap::calculateDiamondCenters(Point square, int distance) {
 void Heightmap::makeLists() {
 	float xyModifier = float((size-1) / 2);
 
+	mesh->vertices.reserve(size * size);
+	mesh->normals.reserve(size * size);
+	mesh->triangles.reserve(2 * (size - 1) * (size - 1));
+
 	for(int z = 0; z < size; z++) {
 		for(int x = 0; x < size; x++) {
 			float worldX = x - xyModifier;
 			float worldZ = -z + xyModifier;
 			float y = getAt(Point(x, z));
 
-			vertices.push_back(vec3(worldX, y, worldZ));
-			normals.push_back(vec3(0, 0, 0));
+			mesh->vertices.push_back(vec3(worldX, y, worldZ));
+			mesh->normals.push_back(vec3(0, 0, 0));
 		}
 	}
 
-	for(int i = 0; i < int(vertices.size()); i++) {
+	for(int i = 0; i < int(mesh->vertices.size()); i++) {
 
 		// Check we haven't reached the edge of the heightmap
-		if((i + 1) % size != 0 && (i + size) < vertices.size()) {
+		if((i + 1) % size != 0 && (i + size) < mesh->vertices.size()) {
 			int nextCol = i + 1;
 			int nextRow = i + size;
 
 			Triangle t = Triangle(i, nextCol, nextRow);
-			triangles.push_back(t);
+			mesh->triangles.push_back(t);
 
 			int nextRowCol = nextRow + 1;
 
 			t = Triangle(nextRow, nextCol, nextRowCol);
-			triangles.push_back(t);
+			mesh->triangles.push_back(t);
 		}
 	}
 
-	// Calculate per face normals iterating over each triangle
-	for(int i = 0; i < int(triangles.size()); i++) {
-		int v1 = triangles[i].vertices[0];
-		int v2 = triangles[i].vertices[1];
-		int v3 = triangles[i].vertices[2];
+	// Calculate per face normals iterating over each triangle,
+	// and add them to the normal of every vertex the face uses
+	for(int i = 0; i < int(mesh->triangles.size()); i++) {
+		uint32_t v1 = mesh->triangles[i].vertices[0];
+		uint32_t v2 = mesh->triangles[i].vertices[1];
+		uint32_t v3 = mesh->triangles[i].vertices[2];
 
 		// point - point = vector, this gives the vectors of
 		// two sides of the triangle
-		vec3 v = vertices[v2] - vertices[v1];
-		vec3 w = vertices[v3] - vertices[v1];
+		vec3 v = mesh->vertices[v2] - mesh->vertices[v1];
+		vec3 w = mesh->vertices[v3] - mesh->vertices[v1];
 		
 		// The face normal is the cross product of the two
 		// vectors
 		vec3 faceNormal = cross(v, w);
 
-		// Add the new normal and assign it to all vertices in the triangle
+		// Add the new normal to all vertices in the triangle
 		for(int j = 0; j < 3; j++) {
-			triangles[i].normal = faceNormal;
+			mesh->normals[mesh->triangles[i].vertices[j]] += faceNormal;
 		}
 	}
 
+	// Each vertex normal is the average direction of the faces around it
+	for(vec3& n : mesh->normals) {
+		n = normalize(n);
+	}
+
 	createDisplayList();
 }
 
@@ -190,24 +196,27 @@ void Heightmap::createDisplayList() {
 	glNewList(displayList, GL_COMPILE);
 	glBegin(GL_TRIANGLES);
 
-	for(int i = 0; i < int(triangles.size()); i++) {
-		Triangle t = triangles[i];
-		vec3 n = t.normal;
+	for(int i = 0; i < int(mesh->triangles.size()); i++) {
+		const Triangle& t = mesh->triangles[i];
+
+		vec3 v1 = mesh->vertices[t.vertices[0]];
+		vec3 v2 = mesh->vertices[t.vertices[1]];
+		vec3 v3 = mesh->vertices[t.vertices[2]];
 
-		vec3 v1 = vertices[t.vertices[0]];
-		vec3 v2 = vertices[t.vertices[1]];
-		vec3 v3 = vertices[t.vertices[2]];
+		vec3 n1 = mesh->normals[t.vertices[0]];
+		vec3 n2 = mesh->normals[t.vertices[1]];
+		vec3 n3 = mesh->normals[t.vertices[2]];
 
 		glTexCoord2f(0.0, 0.0);
-		glNormal3f(n.x, n.y, n.z);
+		glNormal3f(n1.x, n1.y, n1.z);
 		glVertex3f(v1.x, v1.y, v1.z);
 
 		glTexCoord2f(1.0, 0.0);
-		glNormal3f(n.x, n.y, n.z);
+		glNormal3f(n2.x, n2.y, n2.z);
 		glVertex3f(v2.x, v2.y, v2.z);
 
 		glTexCoord2f(1.0, 1.0);
-		glNormal3f(n.x, n.y, n.z);
+		glNormal3f(n3.x, n3.y, n3.z);
 		glVertex3f(v3.x, v3.y, v3.z);
 	}
 
@@ -295,5 +304,5 @@ void Heightmap::printAt(Point point) {
 }
 
 float Heightmap::randomValue() {
-	return math::random<float>(lower, upper);
+	return random.uniform(lower, upper);
 }
\ No newline at end of file
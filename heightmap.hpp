@@ -1,10 +1,13 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "opengl.hpp"
 #include "cgra_math.hpp"
+#include "mesh.hpp"
+#include "rng.hpp"
 #include "triangle.hpp"
 
 namespace hmap {
@@ -25,7 +28,6 @@ namespace hmap {
 	class Heightmap {
 	private:
 		int size;
-		int seed;
 		
 		// Random upper and lower bounds
 		float lower = -1.0;
@@ -38,11 +40,11 @@ namespace hmap {
 		// Random decay rate
 		float randomDecayRate = 0.1;
 
+		rng::Generator random;
+
 		std::vector<std::vector<float>> heightmap;
 
-		std::vector<cgra::vec3> vertices;
-		std::vector<cgra::vec3> normals;
-		std::vector<Triangle> triangles;
+		std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
 
 		GLuint displayList = 0;
 
@@ -62,9 +64,7 @@ namespace hmap {
 		float randomValue();
 		
 	public:
-		Heightmap();
-		Heightmap(int);
-		Heightmap(int, float);
+		Heightmap(int, rng::Generator);
 		~Heightmap();
 
 		void render();
@@ -76,7 +76,8 @@ namespace hmap {
 		void printAt(Point);
 
 		int getSize();
-		std::vector<cgra::vec3> getVertices();
-		std::vector<Triangle> getTriangles();
+		const std::vector<cgra::vec3>& getVertices() const;
+		const std::vector<Triangle>& getTriangles() const;
+		std::shared_ptr<const Mesh> getMesh() const;
 	};
 }
\ No newline at end of file
@@ -1,15 +1,95 @@
+#include <algorithm>
 #include <iostream>
-#include <stack>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "cgra_math.hpp"
 #include "lsystem.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
 
 using namespace cgra;
 using namespace lsys;
 using namespace std;
 
+Alphabet::Alphabet() {
+	symbols.resize(256);
+	for(int i = 0; i < 128; i++) {
+		symbols[i] = string(1, char(i));
+	}
+
+	// The source notation writes pitch up as a logical-and sign,
+	// U+2227, spelled out in UTF-8 so it survives any source charset
+	tokens["\xE2\x88\xA7"] = '^';
+}
+
+Token Alphabet::intern(const string& symbol) {
+	Token token;
+	if(find(symbol, token)) {
+		return token;
+	}
+
+	if(nextToken > 255) {
+		throw runtime_error("Error :: too many distinct symbols in alphabet.");
+	}
+
+	token = Token(nextToken++);
+	tokens[symbol] = token;
+	symbols[token] = symbol;
+	return token;
+}
+
+bool Alphabet::find(const string& symbol, Token& token) const {
+	if(symbol.size() == 1 && (unsigned char)symbol[0] < 128) {
+		token = Token(symbol[0]);
+		return true;
+	}
+
+	map<string, Token>::const_iterator it = tokens.find(symbol);
+	if(it != tokens.end()) {
+		token = it->second;
+		return true;
+	}
+	return false;
+}
+
+string Alphabet::encode(const string& s) {
+	string encoded;
+	encoded.reserve(s.size());
+
+	int i = 0;
+	while(i < int(s.size())) {
+		// The lead byte of a UTF-8 sequence gives its length
+		unsigned char lead = s[i];
+		int length = 1;
+		if(lead >= 0xF0) {
+			length = 4;
+		} else if(lead >= 0xE0) {
+			length = 3;
+		} else if(lead >= 0xC0) {
+			length = 2;
+		}
+		length = min(length, int(s.size()) - i);
+
+		encoded += char(intern(s.substr(i, length)));
+		i += length;
+	}
+
+	return encoded;
+}
+
+const string& Alphabet::getSymbol(Token token) const {
+	return symbols[token];
+}
+
+int Alphabet::getTokenCount() const {
+	return nextToken;
+}
+
 Rule::Rule() {
 	
 }
@@ -41,93 +121,106 @@ Rule::Rule(char c, string t, RuleContext rc, float ch) {
 
 Rule::~Rule() {}
 
-bool Rule::isValid(string check) {
+bool Rule::isValid(const string& check) const {
 	return check != invalid;
 }
 
-bool Rule::matches(char characterMatch, string left, string right) {
-	bool charMatches = (characterMatch == character);
+char Rule::getCharacter() const {
+	return character;
+}
+
+const RuleContext& Rule::getContext() const {
+	return context;
+}
 
-	if(charMatches) {
-		bool leftMatches = isLeftMatch(left);
-		bool rightMatches = isRightMatch(right);
+bool Rule::hasContext() const {
+	return isValid(context.left) || isValid(context.right);
+}
 
-		if(isValid(context.left) && isValid(context.right)) {
-			return leftMatches && rightMatches;
-		} else if(isValid(context.left)) {
-			return leftMatches;
-		} else if(isValid(context.right)) {
-			return rightMatches;
-		}
+bool Rule::matches(const string& s, int index, const ContextIndex& ci) const {
+	if(s[index] != character) {
+		return false;
+	}
+
+	// Context is only evaluated for rules that declare one
+	if(isValid(context.left) && !isLeftMatch(s, index, ci)) {
+		return false;
+	}
+	if(isValid(context.right) && !isRightMatch(s, index, ci)) {
+		return false;
 	}
 
-	return charMatches;
+	return true;
 }
 
-bool Rule::isLeftMatch(string left) {
-	string s;
-	if(left != "" && isValid(context.left)) {
-		s = getCompleteLeftContext(left);
-		if(s.size() > context.left.size()) {
-			s = left.substr(context.left.size(), s.size());
+bool Rule::isLeftMatch(const string& s, int index, const ContextIndex& ci) const {
+	int p = ci.previous[index];
+	for(int i = int(context.left.size()) - 1; i >= 0; i--) {
+		if(p < 0 || s[p] != context.left[i]) {
+			return false;
 		}
+		p = ci.previous[p];
 	}
 
-	return (s == context.left);
+	return true;
 }
 
-bool Rule::isRightMatch(string right) {
-	string s;
-	if(right != "" && isValid(context.right)) {
-		string s = getCompleteRightContext(right).substr(0, context.right.size());
+bool Rule::isRightMatch(const string& s, int index, const ContextIndex& ci) const {
+	int n = ci.next[index];
+	for(int i = 0; i < int(context.right.size()); i++) {
+		if(n < 0 || s[n] != context.right[i]) {
+			return false;
+		}
+		n = ci.next[n];
 	}
 
-	return (s == context.right);
+	return true;
 }
 
-string Rule::getCompleteLeftContext(string s) {
-	stack<bool> skipStack;
-	bool skip = false;
-	string finalString = "";
-	for(int i = s.size()-1; i >= 0; i--) {
-		char c = s.at(i);
+bool lsys::inIgnore(char c) {
+	return (find(ignore.begin(), ignore.end(), c) != ignore.end());
+}
 
-		if(c == ']') {
-			skip = true;
-			skipStack.push(skip);
-		} else if(c == '[') {
-			if(skipStack.size() > 0) {
-				skipStack.pop();
-			}
-			if(skipStack.size() == 0) {
-				skip = false;
-			}
+void ContextIndex::build(const string& s) {
+	int size = int(s.size());
+	brackets.assign(size, -1);
+	previous.assign(size, -1);
+	next.assign(size, -1);
+
+	// Match every ']' with its opening '['
+	vector<int> open;
+	for(int i = 0; i < size; i++) {
+		if(s[i] == '[') {
+			open.push_back(i);
+		} else if(s[i] == ']' && !open.empty()) {
+			brackets[i] = open.back();
+			brackets[open.back()] = i;
+			open.pop_back();
 		}
+	}
 
-		if(!skip) {
-			if(!inIgnore(c)) {
-				finalString += c;
-			}
+	// Nearest context symbol at or before each position, jumping
+	// from a ']' straight past the sub-branch it closes
+	int last = -1;
+	for(int i = 0; i < size; i++) {
+		previous[i] = last;
+
+		char c = s[i];
+		if(c == ']' && brackets[i] >= 0) {
+			last = previous[brackets[i]];
+		} else if(!inIgnore(c)) {
+			last = i;
 		}
 	}
 
-	reverse(finalString.begin(), finalString.end());
-
-	return finalString;
-}
+	int first = -1;
+	for(int i = size - 1; i >= 0; i--) {
+		next[i] = first;
 
-string Rule::getCompleteRightContext(string s) {
-	string finalString = "";
-	for(char c : s) {
-		if(!inIgnore(c)) {
-			finalString += c;
+		if(!inIgnore(s[i])) {
+			first = i;
 		}
 	}
-	return finalString;
-}
-
-bool Rule::inIgnore(char c) {
-	return (find(ignore.begin(), ignore.end(), c) != ignore.end());
 }
 
 void Rule::print() {
@@ -140,63 +233,410 @@ void Rule::print() {
 
 LSystem::LSystem() {}
 
-LSystem::LSystem(string axiom, vector<Rule> r) {
-	strings.push_back(axiom);
+void AliasTable::build(const vector<float>& weights) {
+	int n = int(weights.size());
+	probability.assign(n, 1.0);
+	alias.assign(n, 0);
+
+	float total = 0.0;
+	for(float w : weights) {
+		total += w;
+	}
+	if(n == 0 || total <= 0.0) {
+		return;
+	}
+
+	// Scale so the average weight is 1, then pair each under-full
+	// column with an over-full one that tops it up
+	vector<float> scaled(n);
+	vector<int> small;
+	vector<int> large;
+	for(int i = 0; i < n; i++) {
+		scaled[i] = weights[i] * n / total;
+		if(scaled[i] < 1.0) {
+			small.push_back(i);
+		} else {
+			large.push_back(i);
+		}
+	}
+
+	while(!small.empty() && !large.empty()) {
+		int s = small.back();
+		int l = large.back();
+		small.pop_back();
+		large.pop_back();
+
+		probability[s] = scaled[s];
+		alias[s] = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0f;
+		if(scaled[l] < 1.0) {
+			small.push_back(l);
+		} else {
+			large.push_back(l);
+		}
+	}
+
+	// Anything left over is full up to rounding error
+	for(int i : small) {
+		probability[i] = 1.0;
+	}
+	for(int i : large) {
+		probability[i] = 1.0;
+	}
+}
+
+int AliasTable::sample(float u) const {
+	int n = int(probability.size());
+	float x = u * n;
+	int column = min(int(x), n - 1);
+
+	return (x - column < probability[column]) ? column : alias[column];
+}
+
+bool RuleGroup::isEmpty() const {
+	return contextual.empty() && deterministic < 0 && stochastic.empty();
+}
+
+LSystem::LSystem(string a, vector<Rule> r) {
+	axiom = a;
 	rules = r;
-	currentString = axiom;
+
+	buildDispatch();
+
+	cache = make_shared<ExpansionCache>();
 }
 
 LSystem::~LSystem() {}
 
-vector<string> LSystem::generate() {
-	for(int i = 0; i < int(currentString.size()); i++) {
-		char c = currentString.at(i);
-		string left;
-		string right;
+float GenerationStats::hitRate() const {
+	uint64_t lookups = cacheHits + cacheMisses;
+	return (lookups > 0) ? float(cacheHits) / float(lookups) : 0.0f;
+}
+
+void GenerationStats::print() const {
+	cout << "cache hits: " << cacheHits << ", misses: " << cacheMisses
+		<< ", hit rate: " << hitRate() << endl;
+}
+
+void LSystem::buildDispatch() {
+	dispatch.assign(256, RuleGroup());
+
+	for(int i = 0; i < int(rules.size()); i++) {
+		const Rule& rule = rules[i];
+		RuleGroup& group = dispatch[(unsigned char)rule.getCharacter()];
+
+		if(rule.hasContext()) {
+			group.contextual.push_back(i);
+			hasContextRules = true;
+		} else if(rule.chance != 0.0) {
+			group.stochastic.push_back(i);
+			group.weights.push_back(rule.chance);
+		} else if(group.deterministic < 0) {
+			group.deterministic = i;
+		}
+	}
+
+	for(RuleGroup& group : dispatch) {
+		if(!group.stochastic.empty()) {
+			group.selection.build(group.weights);
+		}
+	}
+}
 
-		if(i-1 > 0)
-			left = currentString.substr(0, i);
-		if(i+1 < int(currentString.size()))
-		 	right = currentString.substr(i+1, currentString.size());
+bool LSystem::isContextFree() const {
+	return !hasContextRules;
+}
 
-		bool ruleMatch = false;
-		vector<Rule> ruleMatches;
+const string& LSystem::getAxiom() const {
+	return axiom;
+}
+
+const string* LSystem::rewriteSymbol(char c, rng::Generator& random) const {
+	return rewriteContextFree(dispatch[(unsigned char)c], random);
+}
+
+const string* LSystem::rewrite(const GenerationBuffers& buffers, int index, rng::Generator& random, vector<int>& ruleMatches) const {
+	const RuleGroup& group = dispatch[(unsigned char)buffers.current[index]];
+
+	if(!group.contextual.empty()) {
 		float probabilitySum = 0.0;
+		ruleMatches.clear();
 
-		for(Rule r : rules) {
-			if(r.matches(c, left, right)) {
-				if(r.chance != 0.0) {
-					ruleMatches.push_back(r);
-					probabilitySum += r.chance;
-				} else {
-					ruleMatch = true;
-					nextString += r.transform;
-					break;
+		for(int i : group.contextual) {
+			const Rule& r = rules[i];
+			if(r.matches(buffers.current, index, buffers.contextIndex)) {
+				if(r.chance == 0.0) {
+					return &r.transform;
 				}
+				ruleMatches.push_back(i);
+				probabilitySum += r.chance;
 			}
 		}
 
-		if(ruleMatches.size() == 0 && !ruleMatch) {
-			nextString += c;
-		} else if(!ruleMatch) {
-			float accumulatedChance = 0.0;
-			for(Rule match : ruleMatches) {
-				float r = math::random(0.0, 1.0);
-				float chance = (match.chance / probabilitySum) + accumulatedChance;
+		if(!ruleMatches.empty()) {
+			float r = random.uniform(0.0f, probabilitySum);
+			for(int i : ruleMatches) {
+				r -= rules[i].chance;
+				if(r < 0.0) {
+					return &rules[i].transform;
+				}
+			}
+			return &rules[ruleMatches.back()].transform;
+		}
+	}
+
+	return rewriteContextFree(group, random);
+}
+
+const string* LSystem::rewriteContextFree(const RuleGroup& group, rng::Generator& random) const {
+	if(group.deterministic >= 0) {
+		return &rules[group.deterministic].transform;
+	}
 
-				if(r <= chance) {
-					nextString += match.transform;
+	if(group.stochastic.empty()) {
+		return nullptr;
+	}
+
+	int selected = group.selection.sample(random.uniform());
+
+	return &rules[group.stochastic[selected]].transform;
+}
+
+// Whether every symbol the expansion of c over the remaining
+// generations can produce is rewritten deterministically and without
+// context, so that expansion is always the same string.
+// Expects the cache mutex to be held.
+bool LSystem::isCacheable(char c, int remaining) const {
+	vector<vector<signed char>>& cacheable = cache->cacheable;
+	if(int(cacheable.size()) <= remaining) {
+		cacheable.resize(remaining + 1, vector<signed char>(256, -1));
+	}
+
+	signed char& known = cacheable[remaining][(unsigned char)c];
+	if(known >= 0) {
+		return known == 1;
+	}
+
+	const RuleGroup& group = dispatch[(unsigned char)c];
+	bool result = true;
+	if(remaining > 0 && !group.isEmpty()) {
+		result = group.contextual.empty() && group.deterministic >= 0;
+		if(result) {
+			for(char t : rules[group.deterministic].transform) {
+				if(!isCacheable(t, remaining - 1)) {
+					result = false;
 					break;
 				}
-				accumulatedChance += chance;
 			}
 		}
 	}
 
-	currentString = nextString;
-	nextString = "";
+	known = result ? 1 : 0;
+	return result;
+}
+
+static const size_t unknownLength = size_t(-1);
+
+// Length of a cacheable expansion, saturating just past the cache
+// limit. Expects the cache mutex to be held.
+size_t LSystem::expandedLength(char c, int remaining) const {
+	vector<vector<size_t>>& lengths = cache->lengths;
+	if(int(lengths.size()) <= remaining) {
+		lengths.resize(remaining + 1, vector<size_t>(256, unknownLength));
+	}
+
+	size_t& known = lengths[remaining][(unsigned char)c];
+	if(known != unknownLength) {
+		return known;
+	}
+
+	const RuleGroup& group = dispatch[(unsigned char)c];
+	size_t length = 1;
+	if(remaining > 0 && group.deterministic >= 0) {
+		length = 0;
+		for(char t : rules[group.deterministic].transform) {
+			length = min(length + expandedLength(t, remaining - 1), size_t(cacheLimit) + 1);
+		}
+	}
+
+	known = length;
+	return length;
+}
+
+// Expects the cache mutex to be held and c to be cacheable
+const string& LSystem::expandCached(char c, int remaining) const {
+	pair<char, int> key = make_pair(c, remaining);
+	map<pair<char, int>, string>::iterator it = cache->expansions.find(key);
+	if(it != cache->expansions.end()) {
+		cache->stats.cacheHits++;
+		return it->second;
+	}
+	cache->stats.cacheMisses++;
+
+	string expansion;
+	const RuleGroup& group = dispatch[(unsigned char)c];
+	if(remaining == 0 || group.deterministic < 0) {
+		expansion = string(1, c);
+	} else {
+		expansion.reserve(expandedLength(c, remaining));
+		for(char t : rules[group.deterministic].transform) {
+			expansion += expandCached(t, remaining - 1);
+		}
+	}
+
+	return cache->expansions[key] = move(expansion);
+}
+
+const string* LSystem::cachedExpansion(char c, int remaining) const {
+	if(remaining <= 0 || dispatch[(unsigned char)c].deterministic < 0) {
+		return nullptr;
+	}
+
+	lock_guard<mutex> lock(cache->mutex);
+	if(!isCacheable(c, remaining) || expandedLength(c, remaining) > size_t(cacheLimit)) {
+		return nullptr;
+	}
 
-	strings.push_back(currentString);
+	// Entries are never removed, so the string stays valid
+	return &expandCached(c, remaining);
+}
+
+GenerationStats LSystem::getStats() const {
+	lock_guard<mutex> lock(cache->mutex);
+	return cache->stats;
+}
+
+void LSystem::rewriteChunk(const GenerationBuffers& buffers, int chunk, string& out, rng::Generator& random) const {
+	const string& current = buffers.current;
+	int start = chunk * chunkSize;
+	int end = min(start + chunkSize, int(current.size()));
+	vector<int> ruleMatches;
+
+	// Reserve based on how much the previous generation grew, so
+	// the output is appended without repeated reallocation
+	out.clear();
+	out.reserve(size_t((end - start) * buffers.growth) + 1);
+
+	for(int i = start; i < end; i++) {
+		char c = current[i];
+		const string* transform = nullptr;
+
+		if(!dispatch[(unsigned char)c].isEmpty()) {
+			transform = rewrite(buffers, i, random, ruleMatches);
+		}
+
+		if(transform != nullptr) {
+			out += *transform;
+		} else {
+			out += c;
+		}
+	}
+}
+
+void LSystem::generate(GenerationBuffers& buffers, rng::Generator& random) const {
+	int size = int(buffers.current.size());
+	int chunkCount = max((size + chunkSize - 1) / chunkSize, 1);
+
+	if(hasContextRules) {
+		buffers.contextIndex.build(buffers.current);
+	}
+
+	if(chunkCount == 1) {
+		rng::Generator chunkRandom = random.split(0);
+		rewriteChunk(buffers, 0, buffers.next, chunkRandom);
+	} else {
+		// Rewrite every chunk into its own buffer. The context index
+		// covers the whole string, so rules near a chunk boundary
+		// still see their real neighbours.
+		vector<string>& chunks = buffers.chunks;
+		chunks.resize(chunkCount);
+		ThreadPool* pool = ThreadPool::shared();
+		pool->parallelFor(chunkCount, [&](int chunk) {
+			rng::Generator chunkRandom = random.split(chunk);
+			rewriteChunk(buffers, chunk, chunks[chunk], chunkRandom);
+		});
+
+		// Prefix sum of the chunk sizes gives each chunk its offset
+		// in the concatenated output
+		vector<size_t> offsets(chunkCount + 1, 0);
+		for(int chunk = 0; chunk < chunkCount; chunk++) {
+			offsets[chunk + 1] = offsets[chunk] + chunks[chunk].size();
+		}
+
+		string& next = buffers.next;
+		next.resize(offsets[chunkCount]);
+		pool->parallelFor(chunkCount, [&](int chunk) {
+			copy(chunks[chunk].begin(), chunks[chunk].end(), next.begin() + offsets[chunk]);
+		});
+	}
+
+	if(size > 0) {
+		buffers.growth = float(buffers.next.size()) / float(size);
+	}
+
+	buffers.current.swap(buffers.next);
+}
+
+// Expands the axiom breadth first. All working state is local, so
+// several expansions of one LSystem can run at the same time.
+string LSystem::expand(int generations, rng::Generator random) const {
+	GenerationBuffers buffers;
+	buffers.current = axiom;
+	for(int i = 0; i < generations; i++) {
+		rng::Generator generationRandom = random.split(i);
+		generate(buffers, generationRandom);
+	}
+
+	return move(buffers.current);
+}
+
+Expansion::Expansion(const LSystem& l, int g, rng::Generator r) {
+	lsystem = &l;
+	generations = g;
+	random = r;
+
+	if(lsystem->isContextFree()) {
+		frames.reserve(generations + 1);
+		frames.push_back({ &lsystem->getAxiom(), 0, 0 });
+	} else {
+		expanded = l.expand(generations, random);
+		frames.push_back({ &expanded, 0, generations });
+	}
+}
+
+bool Expansion::next(char& c) {
+	while(!frames.empty()) {
+		Frame& frame = frames.back();
+		if(frame.position == int(frame.symbols->size())) {
+			frames.pop_back();
+			continue;
+		}
+
+		char symbol = (*frame.symbols)[frame.position++];
+		int depth = frame.depth;
+
+		// A symbol without a production is copied unchanged into
+		// every later generation, so it can be yielded straight away
+		const string* transform = nullptr;
+		if(depth < generations) {
+			// Deterministic subtrees are taken whole from the cache
+			const string* cached = lsystem->cachedExpansion(symbol, generations - depth);
+			if(cached != nullptr) {
+				frames.push_back({ cached, 0, generations });
+				continue;
+			}
+
+			transform = lsystem->rewriteSymbol(symbol, random);
+		}
+
+		if(transform == nullptr) {
+			c = symbol;
+			return true;
+		}
+
+		frames.push_back({ transform, 0, depth + 1 });
+	}
 
-	return strings;
+	return false;
 }
\ No newline at end of file
@@ -1,31 +1,67 @@
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "rng.hpp"
+
 namespace lsys {
 
 	const std::vector<char> ignore = {
 		'[', ']', '+', '-', '\\', '/', '&', '^'
 	};
 
+	typedef unsigned char Token;
+
+	// Interned symbol alphabet. L-system strings hold one token per
+	// symbol: ASCII symbols are their own token, and multi-byte UTF-8
+	// symbols such as '’' are interned to the tokens from 128 upwards.
+	class Alphabet {
+	private:
+		std::map<std::string, Token> tokens;
+		std::vector<std::string> symbols;
+		int nextToken = 128;
+	public:
+		Alphabet();
+		Token intern(const std::string&);
+		bool find(const std::string&, Token&) const;
+		std::string encode(const std::string&);
+		const std::string& getSymbol(Token) const;
+		int getTokenCount() const;
+	};
+
 	struct RuleContext {
 		std::string left = "Z";
 		std::string right = "Z";
 	};
 
+	// Per-generation lookup tables for context matching. previous[i]
+	// and next[i] hold the index of the nearest symbol that can act as
+	// left or right context for position i (or -1), having skipped
+	// ignored symbols and, on the left, complete sub-branches.
+	struct ContextIndex {
+		std::vector<int> brackets;
+		std::vector<int> previous;
+		std::vector<int> next;
+
+		void build(const std::string&);
+	};
+
+	bool inIgnore(char);
+
 	class Rule {
 	private:
 		char character;
 		RuleContext context;
 		std::string invalid = "Z";
 
-		bool isValid(std::string);
-		bool isLeftMatch(std::string);
-		bool isRightMatch(std::string);
-		std::string getCompleteLeftContext(std::string);
-		std::string getCompleteRightContext(std::string);
-		bool inIgnore(char);
+		bool isValid(const std::string&) const;
+		bool isLeftMatch(const std::string&, int, const ContextIndex&) const;
+		bool isRightMatch(const std::string&, int, const ContextIndex&) const;
 	public:
 		std::string transform;
 		float chance = 0.0;
@@ -36,21 +72,126 @@ namespace lsys {
 		Rule(char, std::string, RuleContext);
 		Rule(char, std::string, RuleContext, float);
 		~Rule();
-		bool matches(char, std::string, std::string);
+		char getCharacter() const;
+		const RuleContext& getContext() const;
+		bool hasContext() const;
+		bool matches(const std::string&, int, const ContextIndex&) const;
 		void print();
 	};
 
 
+	// Alias table (Vose's method) for choosing between weighted
+	// outcomes in constant time from a single uniform draw
+	struct AliasTable {
+		std::vector<float> probability;
+		std::vector<int> alias;
+
+		void build(const std::vector<float>&);
+		int sample(float) const;
+	};
+
+	// The rules sharing a predecessor symbol, grouped at construction
+	// so each symbol is rewritten without scanning the whole rule set.
+	// Context-sensitive rules are tried first, in file order, then the
+	// first context-free deterministic rule, then the stochastic rules.
+	struct RuleGroup {
+		std::vector<int> contextual;
+		int deterministic = -1;
+		std::vector<int> stochastic;
+		std::vector<float> weights;
+		AliasTable selection;
+
+		bool isEmpty() const;
+	};
+
+	struct GenerationStats {
+		uint64_t cacheHits = 0;
+		uint64_t cacheMisses = 0;
+
+		float hitRate() const;
+		void print() const;
+	};
+
+	// Memoised expansions of deterministic, context-free symbols keyed
+	// by (symbol, remaining generations). Shared between copies of an
+	// LSystem and guarded by a mutex so trees can expand concurrently.
+	struct ExpansionCache {
+		std::mutex mutex;
+		std::map<std::pair<char, int>, std::string> expansions;
+		std::vector<std::vector<signed char>> cacheable;
+		std::vector<std::vector<size_t>> lengths;
+		GenerationStats stats;
+	};
+
+	// Working state for a breadth-first expansion. Only the current and
+	// next generations are kept, and swapping them lets each generation
+	// reuse the older buffer's allocation. Strings are rewritten in
+	// fixed-size chunks, each with its own random stream, so the result
+	// is the same however many threads the chunks are spread across.
+	struct GenerationBuffers {
+		std::string current;
+		std::string next;
+		ContextIndex contextIndex;
+		std::vector<std::string> chunks;
+		float growth = 1.0;
+	};
+
 	class LSystem {
 	private:
-		std::vector<std::string> strings;
+		std::string axiom = "";
 		std::vector<Rule> rules;
-		std::string currentString = "";
-		std::string nextString = "";
+		std::vector<RuleGroup> dispatch;
+		bool hasContextRules = false;
+
+		std::shared_ptr<ExpansionCache> cache;
+
+		void buildDispatch();
+		bool isCacheable(char, int) const;
+		size_t expandedLength(char, int) const;
+		const std::string& expandCached(char, int) const;
+		void generate(GenerationBuffers&, rng::Generator&) const;
+		void rewriteChunk(const GenerationBuffers&, int, std::string&, rng::Generator&) const;
+		const std::string* rewrite(const GenerationBuffers&, int, rng::Generator&, std::vector<int>&) const;
+		const std::string* rewriteContextFree(const RuleGroup&, rng::Generator&) const;
 	public:
+		static const int chunkSize = 1 << 16;
+		static const int cacheLimit = 1 << 16;
+
 		LSystem();
 		LSystem(std::string, std::vector<Rule>);
 		~LSystem();
-		std::vector<std::string> generate();
+		std::string expand(int, rng::Generator) const;
+
+		bool isContextFree() const;
+		const std::string& getAxiom() const;
+		const std::string* rewriteSymbol(char, rng::Generator&) const;
+		const std::string* cachedExpansion(char, int) const;
+		GenerationStats getStats() const;
+	};
+
+	// Yields the symbols of a final generation one at a time. For
+	// context-free rule sets the expansion is walked depth first from
+	// the axiom, holding at most one production per generation, so the
+	// final string is never materialised. Rules with context need to
+	// see a whole generation, so those are expanded up front instead.
+	class Expansion {
+	private:
+		struct Frame {
+			const std::string* symbols;
+			int position;
+			int depth;
+		};
+
+		const LSystem* lsystem;
+		int generations;
+		rng::Generator random;
+		std::vector<Frame> frames;
+		std::string expanded;
+	public:
+		Expansion(const LSystem&, int, rng::Generator);
+		Expansion(const Expansion&) = delete;
+		Expansion& operator=(const Expansion&) = delete;
+
+		bool next(char&);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "triangle.hpp"
+
+// Indexed triangle mesh with a normal for each vertex. Meshes are
+// built once and then handed out as std::shared_ptr<const Mesh>, so
+// any number of consumers can hold the geometry without copying it.
+struct Mesh {
+	std::vector<cgra::vec3> vertices;
+	std::vector<cgra::vec3> normals;
+	std::vector<Triangle> triangles;
+};
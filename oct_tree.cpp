@@ -15,12 +15,12 @@ OctTree::OctTree(boundingBox box){
 	bounding_box = box;
 }
 
-OctTree::OctTree(boundingBox box, vector<Boid*> obj){
+OctTree::OctTree(boundingBox box, vector<Boid> obj){
 	bounding_box = box;
 	objects = obj;
 }
 
-OctTree::OctTree(vec3 pos, vec3 size, vector<Boid*> obj){
+OctTree::OctTree(vec3 pos, vec3 size, vector<Boid> obj){
 	bounding_box = boundingBox();
 	bounding_box.pos = pos;
 	bounding_box.size = size;
@@ -29,6 +29,16 @@ OctTree::OctTree(vec3 pos, vec3 size, vector<Boid*> obj){
 	buildTree(0);
 }
 
+OctTree::~OctTree(){
+	int i = 0;
+	for(uint8_t flags = activeNodes; flags > 0; flags >>= 1){
+		if((flags & 1) == 1){
+			delete children[i];
+		}
+		++i;
+	}
+}
+
 /*Recursively build an oct tree*/
 void OctTree::buildTree(int level){
 	// cout << "bilbo" << level << endl;
@@ -65,9 +75,9 @@ void OctTree::buildTree(int level){
 	vector<int> moved;
 
 	//Create a list for each of the octants to store objects in
-	vector<Boid*> octantObjects[8];
+	vector<Boid> octantObjects[8];
 	for (int i = 0; i < 8; ++i){
-		octantObjects[i] = vector<Boid*>();
+		octantObjects[i] = vector<Boid>();
 	}
 
 	//For each object in the current cell...
@@ -117,27 +127,30 @@ void OctTree::addOctant(vec3 pos, vec3 size, boundingBox *octant){
 	octant->size = size;
 }
 
-OctTree* OctTree::createNode(boundingBox region, vector<Boid*> obs){
+OctTree* OctTree::createNode(boundingBox region, vector<Boid> obs){
 	OctTree *oct = new OctTree(region, obs);
 	oct->parent = this;
 	return oct;
 }
 
 
-bool OctTree::contains(Boid *boid, boundingBox box){
-	float minX = box.pos.x + boid->minimum_separation;
-	float maxX = box.pos.x + box.size.x - boid->minimum_separation;
-	float minY = box.pos.y + boid->minimum_separation;
-	float maxY = box.pos.y + box.size.y - boid->minimum_separation;
-	float minZ = box.pos.z + boid->minimum_separation;
-	float maxZ = box.pos.z + box.size.z - boid->minimum_separation;
+bool OctTree::contains(const Boid &boid, boundingBox box){
+	vec3 position = boid.position();
+	float separation = boid.minimumSeparation();
+
+	float minX = box.pos.x + separation;
+	float maxX = box.pos.x + box.size.x - separation;
+	float minY = box.pos.y + separation;
+	float maxY = box.pos.y + box.size.y - separation;
+	float minZ = box.pos.z + separation;
+	float maxZ = box.pos.z + box.size.z - separation;
 
 	// cout << ", position: " << box.pos << ", size: " << box.size.x << endl;
-	// cout << "Boid position: x: " << boid->position.x << ", y: " << boid->position.y << ", z: " << boid->position.z << endl;
+	// cout << "Boid position: x: " << position.x << ", y: " << position.y << ", z: " << position.z << endl;
 
-	if(boid->position.x > minX && boid->position.x < maxX 
-		&& boid->position.y > minY && boid->position.y < maxY
-		&& boid->position.z > minZ && boid->position.z < maxZ){
+	if(position.x > minX && position.x < maxX 
+		&& position.y > minY && position.y < maxY
+		&& position.z > minZ && position.z < maxZ){
 		// cout << "true" << endl;
 		return true;
 	}
@@ -155,16 +168,16 @@ float OctTree::lengthVector(vec3 v){
 	return 0;
 }
 
-vector<hitRecord> OctTree::findCollisions(vector<Boid*> parentObs){
+vector<hitRecord> OctTree::findCollisions(vector<Boid> parentObs){
 	vector<hitRecord> collisions;
 
 	//Check parent collisions with objects in this node
-	for(Boid *pBoid : parentObs){
+	for(const Boid &pBoid : parentObs){
 
-		for(Boid *lBoid : objects){
+		for(const Boid &lBoid : objects){
 
-			vec3 f = pBoid->position - lBoid->position;
-			if(lengthVector(f) < pBoid->minimum_separation){
+			vec3 f = pBoid.position() - lBoid.position();
+			if(lengthVector(f) < pBoid.minimumSeparation()){
 				hitRecord hr = hitRecord();
 				hr.boid = pBoid;
 				hr.neighbour = lBoid;
@@ -176,14 +189,14 @@ vector<hitRecord> OctTree::findCollisions(vector<Boid*> parentObs){
 	}
 
 	//Check local collisions in this node
-	for(Boid *lBoid : objects){
+	for(const Boid &lBoid : objects){
 
-		for(Boid *b : objects){
+		for(const Boid &b : objects){
 
-			if(lBoid != b){
+			if(lBoid.index != b.index){
 
-				vec3 f = lBoid->position - b->position;
-				if(lengthVector(f) < lBoid->minimum_separation){
+				vec3 f = lBoid.position() - b.position();
+				if(lengthVector(f) < lBoid.minimumSeparation()){
 					hitRecord hr = hitRecord();
 					hr.boid = lBoid;
 					hr.neighbour = b;
@@ -195,7 +208,7 @@ vector<hitRecord> OctTree::findCollisions(vector<Boid*> parentObs){
 		}
 	}
 
-	for(Boid *b : objects){
+	for(const Boid &b : objects){
 		parentObs.push_back(b);
 	}
 
@@ -13,18 +13,18 @@ struct boundingBox{
 };
 
 struct hitRecord{
-	Boid *boid;
-	Boid *neighbour;
+	Boid boid;
+	Boid neighbour;
 	cgra::vec3 force;
 };
 
 class OctTree{
 private:
-	queue<Boid*> pending_insertion;
+	queue<Boid> pending_insertion;
 
 	boundingBox bounding_box;
 
-	vector<Boid*> objects;
+	vector<Boid> objects;
 
 	int MIN_SIZE = 2;
 	int MAX_LIFESPAN = 8;
@@ -42,16 +42,21 @@ private:
 
 	void buildTree(int level);
 	void addOctant(cgra::vec3 pos, cgra::vec3 size, boundingBox *octant);
-	bool contains(Boid *boid, boundingBox box);
-	OctTree* createNode(boundingBox region, vector<Boid*> obs);
+	bool contains(const Boid &boid, boundingBox box);
+	OctTree* createNode(boundingBox region, vector<Boid> obs);
 	float lengthVector(cgra::vec3 v);
 public:
 	OctTree();
 	OctTree(boundingBox box);
-	OctTree(boundingBox box, vector<Boid*> obj);
-	OctTree(cgra::vec3 pos, cgra::vec3 size, vector<Boid*> obj);
+	OctTree(boundingBox box, vector<Boid> obj);
+	OctTree(cgra::vec3 pos, cgra::vec3 size, vector<Boid> obj);
+	~OctTree();
 
-	vector<hitRecord> findCollisions(vector<Boid*> parentObs);
+	// A tree owns its child nodes, so it can't be copied
+	OctTree(const OctTree&) = delete;
+	OctTree& operator=(const OctTree&) = delete;
+
+	vector<hitRecord> findCollisions(vector<Boid> parentObs);
 	
 	void renderTree(int level);
 };
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rng {
+
+	// Counter-based random number generator. The i-th value of a stream
+	// is a pure function of its key and i, so independent streams can be
+	// split off for each chunk, tree or boid and reproduced exactly no
+	// matter which thread, or in which order, they are consumed.
+	class Generator {
+	private:
+		uint64_t key = 0;
+		uint64_t counter = 0;
+
+	public:
+		Generator() {}
+		explicit Generator(uint64_t seed) {
+			key = mix(seed);
+		}
+
+		// SplitMix64 finaliser
+		static uint64_t mix(uint64_t z) {
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+		uint64_t next() {
+			counter++;
+			return mix(key + counter * 0x9E3779B97F4A7C15ull);
+		}
+
+		// Uniform float in [0, 1)
+		float uniform() {
+			return float(next() >> 40) * (1.0f / 16777216.0f);
+		}
+
+		// Uniform float in [lower, upper)
+		float uniform(float lower, float upper) {
+			return lower + (upper - lower) * uniform();
+		}
+
+		// Uniform int in [0, n)
+		int below(int n) {
+			return int((next() >> 32) * uint64_t(n) >> 32);
+		}
+
+		// An independent stream identified by id. Splitting does not
+		// advance this generator.
+		Generator split(uint64_t id) const {
+			return Generator(key ^ mix(id + 0x632BE59BD9B4E019ull));
+		}
+	};
+}
@@ -0,0 +1,191 @@
+#include <cmath>
+
+#include "steer_kernel.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define STEER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace std;
+
+void steerScalar(const SteerData &d, int begin, int end){
+	for(int i = begin; i < end; ++i){
+		//Unit vector towards the destination, or zero if already there
+		float ax = d.destination_x[i] - d.position_x[i];
+		float ay = d.destination_y[i] - d.position_y[i];
+		float az = d.destination_z[i] - d.position_z[i];
+		float length = sqrt(ax * ax + ay * ay + az * az);
+		if(length != 0){
+			ax /= length;
+			ay /= length;
+			az /= length;
+		}
+
+		float vx = d.velocity_x[i] + (ax * d.align_weight + d.separation_x[i]);
+		float vy = d.velocity_y[i] + (ay * d.align_weight + d.separation_y[i]);
+		float vz = d.velocity_z[i] + (az * d.align_weight + d.separation_z[i]);
+
+		float speed = sqrt(vx * vx + vy * vy + vz * vz);
+		if(speed > d.max_speed){
+			float scale = d.max_speed / speed;
+			vx *= scale;
+			vy *= scale;
+			vz *= scale;
+		}
+
+		d.velocity_x[i] = vx;
+		d.velocity_y[i] = vy;
+		d.velocity_z[i] = vz;
+		d.position_x[i] += vx;
+		d.position_y[i] += vy;
+		d.position_z[i] += vz;
+	}
+}
+
+#ifdef STEER_X86
+
+#ifdef _MSC_VER
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+//rsqrt is only good to about 12 bits, so refine it with one Newton step
+static inline __m128 reciprocalSqrt(__m128 x){
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 xyy = _mm_mul_ps(_mm_mul_ps(x, y), y);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), xyy));
+}
+
+//Four boids at a time. SSE2 is part of every x86-64 CPU.
+static void steerSSE(const SteerData &d, int begin, int end){
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 align_weight = _mm_set1_ps(d.align_weight);
+	const __m128 max_speed = _mm_set1_ps(d.max_speed);
+	const __m128 max_speed_squared = _mm_set1_ps(d.max_speed * d.max_speed);
+
+	int i = begin;
+	for(; i + 4 <= end; i += 4){
+		__m128 px = _mm_loadu_ps(d.position_x + i);
+		__m128 py = _mm_loadu_ps(d.position_y + i);
+		__m128 pz = _mm_loadu_ps(d.position_z + i);
+
+		__m128 ax = _mm_sub_ps(_mm_loadu_ps(d.destination_x + i), px);
+		__m128 ay = _mm_sub_ps(_mm_loadu_ps(d.destination_y + i), py);
+		__m128 az = _mm_sub_ps(_mm_loadu_ps(d.destination_z + i), pz);
+		__m128 length_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(ay, ay)), _mm_mul_ps(az, az));
+		__m128 inverse_length = _mm_and_ps(reciprocalSqrt(length_squared), _mm_cmpgt_ps(length_squared, zero));
+		ax = _mm_mul_ps(ax, inverse_length);
+		ay = _mm_mul_ps(ay, inverse_length);
+		az = _mm_mul_ps(az, inverse_length);
+
+		__m128 vx = _mm_add_ps(_mm_loadu_ps(d.velocity_x + i), _mm_add_ps(_mm_mul_ps(ax, align_weight), _mm_loadu_ps(d.separation_x + i)));
+		__m128 vy = _mm_add_ps(_mm_loadu_ps(d.velocity_y + i), _mm_add_ps(_mm_mul_ps(ay, align_weight), _mm_loadu_ps(d.separation_y + i)));
+		__m128 vz = _mm_add_ps(_mm_loadu_ps(d.velocity_z + i), _mm_add_ps(_mm_mul_ps(az, align_weight), _mm_loadu_ps(d.separation_z + i)));
+
+		__m128 speed_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		__m128 too_fast = _mm_cmpgt_ps(speed_squared, max_speed_squared);
+		__m128 scale = _mm_mul_ps(max_speed, reciprocalSqrt(speed_squared));
+		scale = _mm_or_ps(_mm_and_ps(too_fast, scale), _mm_andnot_ps(too_fast, _mm_set1_ps(1.0f)));
+		vx = _mm_mul_ps(vx, scale);
+		vy = _mm_mul_ps(vy, scale);
+		vz = _mm_mul_ps(vz, scale);
+
+		_mm_storeu_ps(d.velocity_x + i, vx);
+		_mm_storeu_ps(d.velocity_y + i, vy);
+		_mm_storeu_ps(d.velocity_z + i, vz);
+		_mm_storeu_ps(d.position_x + i, _mm_add_ps(px, vx));
+		_mm_storeu_ps(d.position_y + i, _mm_add_ps(py, vy));
+		_mm_storeu_ps(d.position_z + i, _mm_add_ps(pz, vz));
+	}
+
+	steerScalar(d, i, end);
+}
+
+TARGET_AVX2 static inline __m256 reciprocalSqrt(__m256 x){
+	__m256 y = _mm256_rsqrt_ps(x);
+	__m256 xyy = _mm256_mul_ps(_mm256_mul_ps(x, y), y);
+	return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), xyy));
+}
+
+//Eight boids at a time, the same steps as steerSSE
+TARGET_AVX2 static void steerAVX2(const SteerData &d, int begin, int end){
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 align_weight = _mm256_set1_ps(d.align_weight);
+	const __m256 max_speed = _mm256_set1_ps(d.max_speed);
+	const __m256 max_speed_squared = _mm256_set1_ps(d.max_speed * d.max_speed);
+
+	int i = begin;
+	for(; i + 8 <= end; i += 8){
+		__m256 px = _mm256_loadu_ps(d.position_x + i);
+		__m256 py = _mm256_loadu_ps(d.position_y + i);
+		__m256 pz = _mm256_loadu_ps(d.position_z + i);
+
+		__m256 ax = _mm256_sub_ps(_mm256_loadu_ps(d.destination_x + i), px);
+		__m256 ay = _mm256_sub_ps(_mm256_loadu_ps(d.destination_y + i), py);
+		__m256 az = _mm256_sub_ps(_mm256_loadu_ps(d.destination_z + i), pz);
+		__m256 length_squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, ax), _mm256_mul_ps(ay, ay)), _mm256_mul_ps(az, az));
+		__m256 inverse_length = _mm256_and_ps(reciprocalSqrt(length_squared), _mm256_cmp_ps(length_squared, zero, _CMP_GT_OQ));
+		ax = _mm256_mul_ps(ax, inverse_length);
+		ay = _mm256_mul_ps(ay, inverse_length);
+		az = _mm256_mul_ps(az, inverse_length);
+
+		__m256 vx = _mm256_add_ps(_mm256_loadu_ps(d.velocity_x + i), _mm256_add_ps(_mm256_mul_ps(ax, align_weight), _mm256_loadu_ps(d.separation_x + i)));
+		__m256 vy = _mm256_add_ps(_mm256_loadu_ps(d.velocity_y + i), _mm256_add_ps(_mm256_mul_ps(ay, align_weight), _mm256_loadu_ps(d.separation_y + i)));
+		__m256 vz = _mm256_add_ps(_mm256_loadu_ps(d.velocity_z + i), _mm256_add_ps(_mm256_mul_ps(az, align_weight), _mm256_loadu_ps(d.separation_z + i)));
+
+		__m256 speed_squared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+		__m256 too_fast = _mm256_cmp_ps(speed_squared, max_speed_squared, _CMP_GT_OQ);
+		__m256 scale = _mm256_blendv_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(max_speed, reciprocalSqrt(speed_squared)), too_fast);
+		vx = _mm256_mul_ps(vx, scale);
+		vy = _mm256_mul_ps(vy, scale);
+		vz = _mm256_mul_ps(vz, scale);
+
+		_mm256_storeu_ps(d.velocity_x + i, vx);
+		_mm256_storeu_ps(d.velocity_y + i, vy);
+		_mm256_storeu_ps(d.velocity_z + i, vz);
+		_mm256_storeu_ps(d.position_x + i, _mm256_add_ps(px, vx));
+		_mm256_storeu_ps(d.position_y + i, _mm256_add_ps(py, vy));
+		_mm256_storeu_ps(d.position_z + i, _mm256_add_ps(pz, vz));
+	}
+
+	steerScalar(d, i, end);
+}
+
+static bool supportsAVX2(){
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7){
+		return false;
+	}
+
+	//The CPU has to support AVX and the OS has to save the YMM registers
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if(!osxsave || !avx || (_xgetbv(0) & 6) != 6){
+		return false;
+	}
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+SteerKernel steerKernel(){
+#ifdef STEER_X86
+	static SteerKernel kernel = supportsAVX2() ? steerAVX2 : steerSSE;
+	return kernel;
+#else
+	return steerScalar;
+#endif
+}
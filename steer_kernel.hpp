@@ -0,0 +1,29 @@
+#pragma once
+
+// Boid arrays the steering kernels read and write, one entry per boid
+struct SteerData{
+	float *position_x;
+	float *position_y;
+	float *position_z;
+	float *velocity_x;
+	float *velocity_y;
+	float *velocity_z;
+	const float *destination_x;
+	const float *destination_y;
+	const float *destination_z;
+	const float *separation_x;
+	const float *separation_y;
+	const float *separation_z;
+
+	float align_weight;
+	float max_speed;
+};
+
+// Steers boids [begin, end) towards their destinations, adds their
+// separation, clamps their speed to max_speed and moves them
+typedef void (*SteerKernel)(const SteerData &data, int begin, int end);
+
+void steerScalar(const SteerData &data, int begin, int end);
+
+// The widest kernel this CPU supports, chosen on first use
+SteerKernel steerKernel();
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "flock.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
+#include "test.hpp"
+
+using namespace cgra;
+using namespace std;
+using namespace test;
+
+// Largest distance between the same boid in two flocks
+static float maxDifference(const Flock& a, const Flock& b) {
+	float difference = 0.0f;
+	for(int i = 0; i < a.getSize(); i++) {
+		vec3 d = a.getPosition(i) - b.getPosition(i);
+		difference = max(difference, sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+	}
+	return difference;
+}
+
+// The grid only changes which boids are looked at, so it has to give
+// the same separation as checking every boid. Neighbours are summed in
+// a different order, so allow for rounding. Rounding differences grow
+// once a boid ends up either side of the separation distance, so only
+// the first few steps are compared.
+static void gridMatchesNaive() {
+	Flock naive(2000, rng::Generator(5));
+	Flock grid(2000, rng::Generator(5));
+
+	for(int step = 0; step < 5; step++) {
+		naive.update(Separation::Naive);
+		grid.update(Separation::Grid);
+
+		float difference = maxDifference(naive, grid);
+		check(difference < 1e-3f, "grid and naive separation differ by " + to_string(difference)
+			+ " after step " + to_string(step + 1));
+	}
+}
+
+static const Separation modes[] = { Separation::Naive, Separation::Grid, Separation::OctTree };
+static const char* modeNames[] = { "naive", "grid", "oct tree" };
+
+// Positions and velocities of every boid, for exact comparison
+static vector<float> state(const Flock& flock) {
+	vector<float> values;
+	for(int i = 0; i < flock.getSize(); i++) {
+		vec3 p = flock.getPosition(i);
+		vec3 v = flock.getVelocity(i);
+		values.insert(values.end(), { p.x, p.y, p.z, v.x, v.y, v.z });
+	}
+	return values;
+}
+
+// Enough boids that both the separation and steering passes are split
+// into several ranges, stepped on pools of different sizes. Every boid
+// only reads the start of step state, so the results must match
+// exactly, not just to within rounding.
+static void threadCountIndependent() {
+	for(int m = 0; m < 3; m++) {
+		vector<float> expected;
+		for(int threads : { 1, 2, 4 }) {
+			ThreadPool pool(threads - 1);
+			Flock flock(5000, rng::Generator(11));
+			for(int step = 0; step < 3; step++) {
+				flock.update(modes[m], &pool);
+			}
+
+			if(expected.empty()) {
+				expected = state(flock);
+			}
+			check(state(flock) == expected, string(modeNames[m]) + " flock on " + to_string(threads)
+				+ " threads differs from 1 thread");
+		}
+	}
+}
+
+// Times flock steps on every thread count from 1 up to the number of
+// hardware threads, in each separation mode. The naive and oct tree
+// modes are quadratic, so they get fewer boids.
+static void scalingBenchmark() {
+	const int counts[] = { 4000, 50000, 4000 };
+	const int steps = 10;
+	int maxThreads = max(int(thread::hardware_concurrency()), 1);
+
+	for(int m = 0; m < 3; m++) {
+		vector<float> expected;
+		double single = 0.0;
+		for(int threads = 1; threads <= maxThreads; threads++) {
+			ThreadPool pool(threads - 1);
+			Flock flock(counts[m], rng::Generator(7));
+
+			double start = seconds();
+			for(int step = 0; step < steps; step++) {
+				flock.update(modes[m], &pool);
+			}
+			double time = (seconds() - start) / steps;
+
+			if(threads == 1) {
+				expected = state(flock);
+				single = time;
+			}
+			printf("%-8s %6d boids, %2d threads: %8.3f ms/step, %.2fx\n",
+				modeNames[m], counts[m], threads, time * 1000.0, single / time);
+			check(state(flock) == expected, string(modeNames[m]) + " flock on " + to_string(threads)
+				+ " threads differs from 1 thread");
+		}
+	}
+}
+
+static Registration gridMatchesNaiveTest("flock-grid-matches-naive", Kind::Test, gridMatchesNaive);
+static Registration threadCountIndependentTest("flock-thread-count-independent", Kind::Test, threadCountIndependent);
+static Registration scalingBenchmarkTest("flock-scaling", Kind::Benchmark, scalingBenchmark);
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "lsystem.hpp"
+#include "rng.hpp"
+#include "treefactory.hpp"
+#include "test.hpp"
+
+using namespace lsys;
+using namespace std;
+using namespace test;
+using namespace tree;
+
+// The baseline Rule's matching, copied verbatim. It keeps the baseline
+// fields, since the generate loop copies every rule by value, and takes
+// the strings either side of the symbol by value as well.
+struct OriginalRule {
+	char character;
+	RuleContext context;
+	string invalid = "Z";
+	string transform;
+	float chance = 0.0;
+
+	OriginalRule(const Rule& r) {
+		character = r.getCharacter();
+		context = r.getContext();
+		transform = r.transform;
+		chance = r.chance;
+	}
+
+	bool isValid(string check) {
+		return check != invalid;
+	}
+
+	bool matches(char characterMatch, string left, string right) {
+		bool charMatches = (characterMatch == character);
+
+		if(charMatches) {
+			bool leftMatches = isLeftMatch(left);
+			bool rightMatches = isRightMatch(right);
+
+			if(isValid(context.left) && isValid(context.right)) {
+				return leftMatches && rightMatches;
+			} else if(isValid(context.left)) {
+				return leftMatches;
+			} else if(isValid(context.right)) {
+				return rightMatches;
+			}
+		}
+
+		return charMatches;
+	}
+
+	bool isLeftMatch(string left) {
+		string s;
+		if(left != "" && isValid(context.left)) {
+			s = getCompleteLeftContext(left);
+			if(s.size() > context.left.size()) {
+				s = left.substr(context.left.size(), s.size());
+			}
+		}
+
+		return (s == context.left);
+	}
+
+	bool isRightMatch(string right) {
+		string s;
+		if(right != "" && isValid(context.right)) {
+			string s = getCompleteRightContext(right).substr(0, context.right.size());
+		}
+
+		return (s == context.right);
+	}
+
+	string getCompleteLeftContext(string s) {
+		stack<bool> skipStack;
+		bool skip = false;
+		string finalString = "";
+		for(int i = s.size()-1; i >= 0; i--) {
+			char c = s.at(i);
+
+			if(c == ']') {
+				skip = true;
+				skipStack.push(skip);
+			} else if(c == '[') {
+				if(skipStack.size() > 0) {
+					skipStack.pop();
+				}
+				if(skipStack.size() == 0) {
+					skip = false;
+				}
+			}
+
+			if(!skip) {
+				if(!inIgnore(c)) {
+					finalString += c;
+				}
+			}
+		}
+
+		reverse(finalString.begin(), finalString.end());
+
+		return finalString;
+	}
+
+	string getCompleteRightContext(string s) {
+		string finalString = "";
+		for(char c : s) {
+			if(!inIgnore(c)) {
+				finalString += c;
+			}
+		}
+		return finalString;
+	}
+};
+
+// The original generate loop, kept as the reference that the linear
+// rewrite is measured against. Every symbol copies the strings either
+// side of it and every rule, so a generation is quadratic in length.
+// Only the random source differs, so both use the same generator.
+static string originalGenerate(const string& current, const vector<OriginalRule>& rules, rng::Generator& random) {
+	string next;
+	for(int i = 0; i < int(current.size()); i++) {
+		char c = current[i];
+		string left;
+		string right;
+
+		if(i - 1 > 0)
+			left = current.substr(0, i);
+		if(i + 1 < int(current.size()))
+			right = current.substr(i + 1, current.size());
+
+		bool ruleMatch = false;
+		vector<OriginalRule> ruleMatches;
+		float probabilitySum = 0.0;
+
+		for(OriginalRule r : rules) {
+			if(r.matches(c, left, right)) {
+				if(r.chance != 0.0) {
+					ruleMatches.push_back(r);
+					probabilitySum += r.chance;
+				} else {
+					ruleMatch = true;
+					next += r.transform;
+					break;
+				}
+			}
+		}
+
+		if(ruleMatches.size() == 0 && !ruleMatch) {
+			next += c;
+		} else if(!ruleMatch) {
+			float accumulatedChance = 0.0;
+			for(OriginalRule match : ruleMatches) {
+				float r = random.uniform();
+				float chance = (match.chance / probabilitySum) + accumulatedChance;
+
+				if(r <= chance) {
+					next += match.transform;
+					break;
+				}
+				accumulatedChance += chance;
+			}
+		}
+	}
+	return next;
+}
+
+// Expands every species in trees2.txt to 5 to 8 generations and reports
+// how fast the final strings are produced. The original loop is only run
+// while its strings stay small enough to finish, and both are compared
+// over that same set of expansions.
+static void expandBenchmark() {
+	Alphabet alphabet;
+	vector<TreeGenerator> species = TreeFactory::readSpecies("res/trees/trees2.txt", alphabet);
+	check(!species.empty(), "no species in res/trees/trees2.txt");
+
+	// Expansions predicted to grow past these sizes are skipped
+	const size_t maxSymbols = size_t(1) << 25;
+	const size_t maxOriginalSymbols = size_t(1) << 15;
+
+	for(int generations = 5; generations <= 8; generations++) {
+		int expansions = 0;
+		double symbols = 0;
+		double time = 0;
+		int compared = 0;
+		double comparedSymbols = 0;
+		double comparedTime = 0;
+		double originalSymbols = 0;
+		double originalTime = 0;
+
+		for(const TreeGenerator& t : species) {
+			rng::Generator random(generations);
+
+			// Predict the final size from how much the last generation grew
+			size_t before = max(t.lsystem.expand(generations - 2, random).size(), size_t(1));
+			size_t last = t.lsystem.expand(generations - 1, random).size();
+			size_t predicted = size_t(double(last) * last / before);
+			if(predicted > maxSymbols) {
+				continue;
+			}
+
+			double start = seconds();
+			string expanded = t.lsystem.expand(generations, random);
+			double elapsed = seconds() - start;
+
+			expansions++;
+			symbols += expanded.size();
+			time += elapsed;
+
+			if(predicted > maxOriginalSymbols) {
+				continue;
+			}
+
+			vector<OriginalRule> originalRules(t.rules.begin(), t.rules.end());
+			start = seconds();
+			string original = t.lsystem.getAxiom();
+			for(int g = 0; g < generations; g++) {
+				rng::Generator generationRandom = random.split(g);
+				original = originalGenerate(original, originalRules, generationRandom);
+			}
+			originalTime += seconds() - start;
+			originalSymbols += original.size();
+
+			compared++;
+			comparedSymbols += expanded.size();
+			comparedTime += elapsed;
+		}
+
+		printf("%d generations: %d species, %.0f symbols at %.3g symbols/s\n",
+			generations, expansions, symbols, symbols / time);
+		if(compared > 0) {
+			printf("    original loop on %d of them: %.3g symbols/s, rewrite %.3g symbols/s\n",
+				compared, originalSymbols / originalTime, comparedSymbols / comparedTime);
+		}
+	}
+}
+
+// Rewrites symbol many times and checks that each stochastic production
+// comes up in proportion to its rulechance. Identical productions are
+// counted together, as the rewrite can't tell them apart.
+static void checkFrequencies(const LSystem& lsystem, const vector<Rule>& rules, char symbol) {
+	const int draws = 400000;
+
+	map<string, double> expected;
+	float total = 0.0;
+	for(const Rule& r : rules) {
+		if(r.getCharacter() == symbol && r.chance != 0.0 && !r.hasContext()) {
+			expected[r.transform] += r.chance;
+			total += r.chance;
+		}
+	}
+	check(total > 0.0, string("no stochastic rules for ") + symbol);
+
+	map<string, int> observed;
+	rng::Generator random((unsigned char)symbol);
+	for(int i = 0; i < draws; i++) {
+		const string* transform = lsystem.rewriteSymbol(symbol, random);
+		check(transform != nullptr, string("no production for ") + symbol);
+		observed[*transform]++;
+	}
+
+	for(const pair<const string, int>& o : observed) {
+		check(expected.count(o.first) > 0, "unexpected production " + o.first);
+	}
+
+	// Every draw is independent, so each count is binomial. Allowing
+	// five standard errors keeps a correct table from failing by chance.
+	for(const pair<const string, double>& e : expected) {
+		double p = e.second / total;
+		double frequency = double(observed[e.first]) / draws;
+		double tolerance = 5.0 * sqrt(p * (1.0 - p) / draws);
+		check(fabs(frequency - p) <= tolerance,
+			string("production of ") + symbol + " chosen " + to_string(frequency)
+			+ " of the time, expected " + to_string(p));
+	}
+}
+
+static void stochasticFrequencies() {
+	vector<Rule> rules = {
+		Rule('S', "a", 3.0f),
+		Rule('S', "b", 1.0f),
+		Rule('S', "c", 2.0f),
+		Rule('S', "d", 0.5f)
+	};
+	checkFrequencies(LSystem("S", rules), rules, 'S');
+
+	// The A and D rules of the first species in trees.txt
+	Alphabet alphabet;
+	vector<TreeGenerator> species = TreeFactory::readSpecies("res/trees/trees.txt", alphabet);
+	check(!species.empty(), "no species in res/trees/trees.txt");
+	checkFrequencies(species[0].lsystem, species[0].rules, 'A');
+	checkFrequencies(species[0].lsystem, species[0].rules, 'D');
+}
+
+static Registration stochasticFrequenciesTest("lsystem-stochastic-frequencies", Kind::Test, stochasticFrequencies);
+static Registration expandBenchmarkTest("lsystem-expand", Kind::Benchmark, expandBenchmark);
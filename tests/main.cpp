@@ -0,0 +1,83 @@
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "test.hpp"
+
+using namespace std;
+using namespace test;
+
+struct TestCase {
+	const char* name;
+	Kind kind;
+	TestFunction function;
+};
+
+// Function local so it exists before any file's registrations run
+static vector<TestCase>& testCases() {
+	static vector<TestCase> cases;
+	return cases;
+}
+
+Registration::Registration(const char* name, Kind kind, TestFunction function) {
+	testCases().push_back({ name, kind, function });
+}
+
+void test::check(bool condition, const string& message) {
+	if(!condition) {
+		throw runtime_error(message);
+	}
+}
+
+// Usage:
+//     Forest-Simulator-Tests            runs every test
+//     Forest-Simulator-Tests --bench    runs every test and benchmark
+//     Forest-Simulator-Tests name...    runs the named tests or benchmarks
+// Resource files are opened relative to the repository root, so run it
+// from there.
+int main(int argc, char** argv) {
+	bool benchmarks = false;
+	vector<string> names;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--bench") == 0) {
+			benchmarks = true;
+		} else {
+			names.push_back(argv[i]);
+		}
+	}
+
+	int run = 0;
+	int failed = 0;
+	for(const TestCase& t : testCases()) {
+		bool selected = false;
+		if(names.empty()) {
+			selected = t.kind == Kind::Test || benchmarks;
+		}
+		for(const string& name : names) {
+			selected = selected || name == t.name;
+		}
+		if(!selected) {
+			continue;
+		}
+
+		cout << "[ run  ] " << t.name << endl;
+		run++;
+		try {
+			t.function();
+			cout << "[ pass ] " << t.name << endl;
+		} catch(const exception& e) {
+			cout << "[ FAIL ] " << t.name << ": " << e.what() << endl;
+			failed++;
+		}
+	}
+
+	if(run == 0) {
+		cerr << "No tests matched" << endl;
+		return 1;
+	}
+
+	cout << run - failed << " of " << run << " passed" << endl;
+	return failed > 0 ? 1 : 0;
+}
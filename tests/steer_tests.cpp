@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "rng.hpp"
+#include "steer_kernel.hpp"
+#include "test.hpp"
+
+using namespace std;
+using namespace test;
+
+// Random boid arrays in the layout the steering kernels work on
+struct SteerArrays{
+	vector<float> arrays[12];
+
+	SteerArrays(int count, uint64_t seed){
+		rng::Generator random(seed);
+		for(int a = 0; a < 12; a++){
+			arrays[a].resize(count);
+			for(float &value : arrays[a]){
+				value = random.uniform(-3.0f, 3.0f);
+			}
+		}
+
+		// Separations are small next to the steering, and some boids
+		// sit on their destination or have stopped, which the kernels
+		// have to handle without dividing by zero
+		for(int a = 9; a < 12; a++){
+			for(float &value : arrays[a]){
+				value *= 0.01f;
+			}
+		}
+		for(int i = 0; i < count; i += 97){
+			arrays[6][i] = arrays[0][i];
+			arrays[7][i] = arrays[1][i];
+			arrays[8][i] = arrays[2][i];
+		}
+		for(int i = 0; i < count; i += 89){
+			arrays[3][i] = arrays[4][i] = arrays[5][i] = 0.0f;
+		}
+	}
+
+	int size() const{
+		return int(arrays[0].size());
+	}
+
+	SteerData data(){
+		SteerData d;
+		d.position_x = arrays[0].data();
+		d.position_y = arrays[1].data();
+		d.position_z = arrays[2].data();
+		d.velocity_x = arrays[3].data();
+		d.velocity_y = arrays[4].data();
+		d.velocity_z = arrays[5].data();
+		d.destination_x = arrays[6].data();
+		d.destination_y = arrays[7].data();
+		d.destination_z = arrays[8].data();
+		d.separation_x = arrays[9].data();
+		d.separation_y = arrays[10].data();
+		d.separation_z = arrays[11].data();
+		d.align_weight = 0.015f;
+		d.max_speed = 0.2f;
+		return d;
+	}
+};
+
+// Steps the same boids once with the scalar kernel and once with the
+// selected one, and returns the largest difference in what they wrote
+static float kernelDifference(int count){
+	SteerArrays scalar(count, count);
+	SteerArrays selected(count, count);
+	steerScalar(scalar.data(), 0, count);
+	steerKernel()(selected.data(), 0, count);
+
+	float difference = 0.0f;
+	for(int a = 0; a < 6; a++){
+		for(int i = 0; i < count; i++){
+			difference = max(difference, fabs(scalar.arrays[a][i] - selected.arrays[a][i]));
+		}
+	}
+	return difference;
+}
+
+// Boid counts that are not a multiple of the vector width exercise the
+// scalar tail as well as the vector loop
+static void simdMatchesScalar(){
+	for(int count : { 1, 7, 8, 9, 1003 }){
+		float difference = kernelDifference(count);
+		check(difference < 1e-5f, "kernels differ by " + to_string(difference) + " for "
+			+ to_string(count) + " boids");
+	}
+}
+
+// Boid updates per second for one kernel, over about 2e7 updates
+static double updatesPerSecond(SteerKernel kernel, int count){
+	SteerArrays boids(count, 1);
+	SteerData data = boids.data();
+	int steps = max(20000000 / count, 1);
+
+	double start = seconds();
+	for(int step = 0; step < steps; step++){
+		kernel(data, 0, count);
+	}
+	return double(steps) * count / (seconds() - start);
+}
+
+static void kernelBenchmark(){
+	if(steerKernel() == steerScalar){
+		printf("no SIMD kernel on this CPU, comparing scalar with itself\n");
+	}
+
+	for(int count : { 1000, 10000, 100000 }){
+		float difference = kernelDifference(count);
+		double scalar = updatesPerSecond(steerScalar, count);
+		double selected = updatesPerSecond(steerKernel(), count);
+		printf("%6d boids: scalar %.3g updates/s, SIMD %.3g updates/s (%.1fx), max difference %g\n",
+			count, scalar, selected, selected / scalar, difference);
+		check(difference < 1e-5f, "kernels differ by " + to_string(difference));
+	}
+}
+
+static Registration simdMatchesScalarTest("steer-simd-matches-scalar", Kind::Test, simdMatchesScalar);
+static Registration kernelBenchmarkTest("steer-kernel", Kind::Benchmark, kernelBenchmark);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Small headless test runner. Each test or benchmark is a function
+// registered by a static Registration in the file that defines it.
+// Tests report failure by throwing, like the rest of the code.
+namespace test {
+
+	typedef void (*TestFunction)();
+
+	enum class Kind {
+		Test,		// run by default, checks behaviour
+		Benchmark	// only run when asked for, reports throughput
+	};
+
+	struct Registration {
+		Registration(const char* name, Kind kind, TestFunction function);
+	};
+
+	// Throws a runtime_error with the message if condition is false
+	void check(bool condition, const std::string& message);
+
+	// Seconds since some fixed point, for timing benchmarks
+	inline double seconds() {
+		typedef std::chrono::steady_clock clock;
+		return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+	}
+}
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cgra_math.hpp"
+#include "lsystem.hpp"
+#include "rng.hpp"
+#include "tree.hpp"
+#include "treefactory.hpp"
+#include "test.hpp"
+
+using namespace cgra;
+using namespace lsys;
+using namespace std;
+using namespace test;
+using namespace tree;
+
+// Branching, stochastic and with a leaf polygon, so the turtle takes
+// every kind of path through the interpreter
+static LSystem branchingSystem(Alphabet& alphabet) {
+	vector<Rule> rules = {
+		Rule('X', alphabet.encode("F[+X][-X]GX"), 1.0f),
+		Rule('X', alphabet.encode("G[&X]’F{.f.f.}X"), 1.0f),
+		Rule('F', alphabet.encode("FG"), 2.0f),
+		Rule('F', alphabet.encode("F"), 1.0f)
+	};
+	return LSystem(alphabet.encode("X"), rules);
+}
+
+// Every F or G draws one segment, which joins two rings with two
+// triangles per ring vertex. The batch is what createDisplayList sends
+// to GL, so its size is checked as well as the mesh it is built from.
+// Sending earlier branches again for each new segment, as the display
+// list once did, makes the batch grow with the square of the segments.
+static void branchTriangleCount() {
+	Alphabet alphabet;
+	LSystem lsystem = branchingSystem(alphabet);
+	vector<vec3> palette = { vec3(0.5, 0.3, 0.1), vec3(0.1, 0.6, 0.1) };
+
+	for(int ringResolution : { 3, 6, 11 }) {
+		for(int seed = 0; seed < 4; seed++) {
+			rng::Generator random(seed);
+
+			int segments = 0;
+			Expansion symbols(lsystem, 6, random);
+			char c;
+			while(symbols.next(c)) {
+				if(c == 'F' || c == 'G') {
+					segments++;
+				}
+			}
+
+			Expansion expansion(lsystem, 6, random);
+			Tree t(expansion, 25.0, 1.0, palette, ringResolution, alphabet);
+
+			BranchBatch batch = t.buildBranchBatch();
+			string drawn = to_string(segments) + " segments at resolution " + to_string(ringResolution);
+
+			check(segments > 0, "expansion drew no branches");
+			check(t.getTriangleCount() == 2 * ringResolution * segments,
+				drawn + " gave " + to_string(t.getTriangleCount()) + " triangles");
+			check(batch.getVertexCount() == 3 * 2 * ringResolution * segments,
+				drawn + " sent " + to_string(batch.getVertexCount()) + " vertices to GL");
+			check(batch.normals.size() == batch.vertices.size(),
+				drawn + " sent " + to_string(batch.normals.size() / 3) + " normals to GL");
+		}
+	}
+}
+
+static Registration branchTriangleCountTest("tree-branch-triangle-count", Kind::Test, branchTriangleCount);
+
+// Interprets a multi-million symbol string into a branch mesh. The
+// string is expanded up front and fed back as the axiom of an L-system
+// with no rules, so the timing is the turtle and mesh building alone.
+static void interpretBenchmark() {
+	const size_t minSymbols = size_t(4) << 20;
+
+	Alphabet alphabet;
+	vector<TreeGenerator> species = TreeFactory::readSpecies("res/trees/trees.txt", alphabet);
+	check(!species.empty(), "no species in res/trees/trees.txt");
+
+	// Use the first species that keeps growing to a big enough string.
+	// Some stop growing once every symbol has become a leaf.
+	string symbols;
+	const TreeGenerator* chosen = nullptr;
+	for(const TreeGenerator& t : species) {
+		for(int generations = int(t.generations); generations <= 12; generations++) {
+			symbols = t.lsystem.expand(generations, rng::Generator(generations));
+			if(symbols.size() >= minSymbols) {
+				chosen = &t;
+				break;
+			}
+		}
+		if(chosen != nullptr) {
+			break;
+		}
+	}
+	check(chosen != nullptr, "no species in res/trees/trees.txt grows to " + to_string(minSymbols) + " symbols");
+	const TreeGenerator& t = *chosen;
+	LSystem literal(symbols, vector<Rule>());
+
+	// Streaming the string through without a turtle, for reference
+	double start = seconds();
+	Expansion drain(literal, 0, rng::Generator(0));
+	char c;
+	size_t streamed = 0;
+	while(drain.next(c)) {
+		streamed++;
+	}
+	double streamTime = seconds() - start;
+
+	start = seconds();
+	Expansion expansion(literal, 0, rng::Generator(0));
+	Tree interpreted(expansion, t.branchAngle, t.startLength[0], t.colours, t.ringResolution, alphabet);
+	double time = seconds() - start;
+
+	check(streamed == symbols.size(), "streamed symbols do not match the string");
+	printf("%zu symbols, %d triangles\n", symbols.size(), interpreted.getTriangleCount());
+	printf("interpreted at %.3g symbols/s (streaming alone %.3g symbols/s)\n",
+		symbols.size() / time, symbols.size() / streamTime);
+}
+
+static Registration interpretBenchmarkTest("tree-interpret", Kind::Benchmark, interpretBenchmark);
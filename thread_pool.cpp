@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+using namespace std;
+
+// The pool and worker index of the current thread, if it is a worker,
+// so that tasks it submits go on its own deque
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+// State shared between the caller of parallelFor and its helpers. It is
+// reference counted because helpers may only get scheduled after the
+// caller has already finished every range and returned.
+struct ParallelJob {
+	const function<void(int, int)>* body;
+	int count;
+	int grain;
+	atomic<int> nextIndex;
+	atomic<int> completed;
+	mutex doneMutex;
+	condition_variable done;
+
+	void run() {
+		int finished = 0;
+		for(int begin = nextIndex.fetch_add(grain); begin < count; begin = nextIndex.fetch_add(grain)) {
+			int end = min(begin + grain, count);
+			(*body)(begin, end);
+			finished += end - begin;
+		}
+
+		if(finished > 0 && (completed += finished) == count) {
+			lock_guard<mutex> lock(doneMutex);
+			done.notify_all();
+		}
+	}
+};
+
+ThreadPool::ThreadPool(int threads) {
+	for(int i = 0; i < threads; i++) {
+		queues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+	}
+	for(int i = 0; i < threads; i++) {
+		workers.push_back(thread(&ThreadPool::work, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for(thread& t : workers) {
+		t.join();
+	}
+}
+
+int ThreadPool::size() {
+	return int(workers.size());
+}
+
+void ThreadPool::work(int index) {
+	currentPool = this;
+	currentWorker = index;
+
+	while(true) {
+		function<void()> task;
+		if(take(index, task)) {
+			task();
+			continue;
+		}
+
+		unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this] { return stopping || pending > 0; });
+
+		if(stopping && pending == 0) {
+			return;
+		}
+	}
+}
+
+bool ThreadPool::take(int index, function<void()>& task) {
+	// Newest task from our own deque first, while its data is
+	// still likely to be in cache
+	{
+		WorkQueue& own = *queues[index];
+		lock_guard<std::mutex> lock(own.mutex);
+		if(!own.tasks.empty()) {
+			task = move(own.tasks.back());
+			own.tasks.pop_back();
+			pending--;
+			return true;
+		}
+	}
+
+	// Otherwise steal the oldest task from another worker
+	int count = int(queues.size());
+	for(int i = 1; i < count; i++) {
+		WorkQueue& victim = *queues[(index + i) % count];
+		lock_guard<std::mutex> lock(victim.mutex);
+		if(!victim.tasks.empty()) {
+			task = move(victim.tasks.front());
+			victim.tasks.pop_front();
+			pending--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::submit(function<void()> task) {
+	// Workers keep the tasks they create, and other threads
+	// spread theirs across the workers
+	int index = (currentPool == this) ? currentWorker : int(nextQueue++ % queues.size());
+	{
+		WorkQueue& queue = *queues[index];
+		lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(move(task));
+	}
+	{
+		lock_guard<std::mutex> lock(mutex);
+		pending++;
+	}
+	condition.notify_one();
+}
+
+void ThreadPool::parallelFor(int count, const function<void(int)>& body) {
+	parallelFor(count, 1, [&body](int begin, int end) {
+		for(int i = begin; i < end; i++) {
+			body(i);
+		}
+	});
+}
+
+void ThreadPool::parallelFor(int count, int grain, const function<void(int, int)>& body) {
+	if(count <= 0) {
+		return;
+	}
+	grain = max(grain, 1);
+
+	shared_ptr<ParallelJob> job = make_shared<ParallelJob>();
+	job->body = &body;
+	job->count = count;
+	job->grain = grain;
+	job->nextIndex = 0;
+	job->completed = 0;
+
+	int ranges = (count + grain - 1) / grain;
+	int helpers = min(size(), ranges - 1);
+	for(int i = 0; i < helpers; i++) {
+		submit([job] { job->run(); });
+	}
+
+	job->run();
+
+	unique_lock<std::mutex> lock(job->doneMutex);
+	job->done.wait(lock, [&job] { return job->completed == job->count; });
+}
+
+ThreadPool* ThreadPool::shared() {
+	static ThreadPool pool(max(int(thread::hardware_concurrency()) - 1, 0));
+	return &pool;
+}
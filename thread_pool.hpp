@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Each worker has its own deque of tasks:
+// it runs the newest task from the back of its own deque, and when
+// that is empty steals the oldest task from the front of another's.
+class ThreadPool {
+private:
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+	std::atomic<int> pending{0};
+	std::atomic<unsigned> nextQueue{0};
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+
+	void work(int);
+	bool take(int, std::function<void()>&);
+	void submit(std::function<void()>);
+public:
+	ThreadPool(int threads);
+	~ThreadPool();
+
+	int size();
+
+	// Runs body(i) for every i in [0, count). The calling thread takes
+	// part in the work, and the call returns once every index is done.
+	void parallelFor(int count, const std::function<void(int)>& body);
+
+	// Runs body(begin, end) over consecutive ranges of up to grain
+	// indices that together cover [0, count)
+	void parallelFor(int count, int grain, const std::function<void(int, int)>& body);
+
+	// Process-wide pool with one worker per additional hardware thread
+	static ThreadPool* shared();
+};
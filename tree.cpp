@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -36,175 +37,241 @@ void setMaterial(vec3 colour) {
 	glMaterialfv(GL_BACK, GL_SHININESS, mat_shininess);
 }
 
-vec3 translate(vec3 start, vec3 translation) {
-	vec4 newStart = vec4(start.x, start.y, start.z, 1);
-	mat4 translationMatrix = mat4(
-		vec4(1, 0, 0, translation.x),
-		vec4(0, 1, 0, translation.y),
-		vec4(0, 0, 1, translation.z),
-		vec4(0, 0, 0, 1)
-	);
-
-	vec3 ns = vec3(
-		dot(newStart, translationMatrix[0]),
-		dot(newStart, translationMatrix[1]),
-		dot(newStart, translationMatrix[2])
-	);
-
-	return ns;
-}
-
-mat4 makeRotationMatrix(vec3 rotationAxis, float angle) {
+mat3 makeRotationMatrix(vec3 rotationAxis, float angle) {
 	// Ensure rotation axis is normalized
 	vec3 u = normalize(rotationAxis);
 
 	// Convert angle from degrees to radians
 	float a = radians(angle);
+	float c = cos(a);
+	float s = sin(a);
+	float t = 1 - c;
 
-	// Create the rotation matrix based on axis and angle.
+	// Create the rotation matrix based on axis and angle, one column at a time.
 	// See: https://en.wikipedia.org/wiki/Rotation_matrix#Rotation_matrix_from_axis_and_angle
-	mat4 rotationMatrix = mat4(
-		vec4(cos(a) + (pow(u.x, 2) * (1 - cos(a))), u.x * u.y * (1 - cos(a)) - u.z * sin(a), u.x * u.y * (1 - cos(a)) + u.y * sin(a), 0.0f),
-		vec4(u.y * u.x * (1 - cos(a)) + u.z * sin(a), cos(a) + pow(u.y, 2) * (1 - cos(a)), u.y * u.x * (1 - cos(a)) - u.x * sin(a), 0.0f),
-		vec4(u.z * u.x * (1 - cos(a)) - u.y * sin(a), u.z * u.y * (1 - cos(a)) + u.x * sin(a), cos(a) + pow(u.z, 2) * (1 - cos(a)), 0.0f),
-		vec4(0.0f, 0.0f, 0.0f, 1.0f)
+	return mat3(
+		c + u.x * u.x * t, u.y * u.x * t + u.z * s, u.z * u.x * t - u.y * s,
+		u.x * u.y * t - u.z * s, c + u.y * u.y * t, u.z * u.y * t + u.x * s,
+		u.x * u.z * t + u.y * s, u.y * u.z * t - u.x * s, c + u.z * u.z * t
 	);
-
-	return rotationMatrix;
 }
 
-mat4 rotate(mat4 start, vec3 rotationAxis, float angle) {
-	mat4 rotationMatrix = makeRotationMatrix(rotationAxis, angle);
-	mat4 m = rotationMatrix * start;
-	return m;
+void TreeState::turn(const mat3& rotation) {
+	// Rotate about the turtle's own axes
+	orientation = orientation * rotation;
+
+	// Rounding error slowly skews the frame over many turns,
+	// so periodically square it back up
+	turns++;
+	if(turns >= 32) {
+		vec3 h = normalize(orientation[2]);
+		vec3 l = normalize(cross(orientation[1], h));
+		orientation = mat3(l, cross(h, l), h);
+		turns = 0;
+	}
 }
 
 Tree::Tree() {
 	
 }
 
-Tree::Tree(vec3 startingPos, vector<string> s, float a, float l, vector<vec3> colours) {
-	strings = s;
-	state.position = startingPos;
+Tree::Tree(lsys::Expansion& expansion, float a, float l, vector<vec3> palette, int ringResolution, const lsys::Alphabet& alphabet) {
 	state.angle = a;
 	state.length = l;
-	state.colours = colours;
-
-	functionMap = {
-		{'F', &Tree::drawBranchPlaceVertex},
-		{'G', &Tree::drawBranch},
-		{'f', &Tree::moveForwardPlaceVertex},
-		{'g', &Tree::moveForward},
-		{'[', &Tree::pushState},
-		{']', &Tree::popState},
-		{'{', &Tree::beginPoly},
-		{'}', &Tree::endPoly},
-		{'+', &Tree::turnLeft},
-		{'-', &Tree::turnRight},
-		{'^', &Tree::pitchUp},
-		{'&', &Tree::pitchDown},
-		{'\\', &Tree::rollLeft},
-		{'/', &Tree::rollRight},
-		{'|', &Tree::turnAround},
-		{'’', &Tree::increaseColourIndex},
-		{';', &Tree::decreaseColourIndex},
-		{'#', &Tree::increaseLineWidth},
-		{'!', &Tree::decreaseLineWidth},
-		{'.', &Tree::placeVertex}
+	colours = palette;
+
+	ringResolution = max(ringResolution, 3);
+	for(int i = 0; i < ringResolution; i++) {
+		float theta = 2 * math::pi() * i / ringResolution;
+		ringOffsets.push_back(vec2(cos(theta), sin(theta)));
+	}
+
+	// Room for typically deep branching, so pushes rarely reallocate
+	stateStack.reserve(64);
+
+	turnLeftRotation = makeRotationMatrix(up, a);
+	turnRightRotation = makeRotationMatrix(up, -a);
+	pitchUpRotation = makeRotationMatrix(left, a);
+	pitchDownRotation = makeRotationMatrix(left, -a);
+	rollLeftRotation = makeRotationMatrix(heading, a);
+	rollRightRotation = makeRotationMatrix(heading, -a);
+	turnAroundRotation = makeRotationMatrix(up, 180.0);
+
+	// Turtle commands by symbol. Multi-byte symbols are spelled out
+	// in UTF-8 and looked up in the alphabet to find their token.
+	const vector<pair<string, RenderFunction>> commands = {
+		{"F", &Tree::drawBranchPlaceVertex},
+		{"G", &Tree::drawBranch},
+		{"f", &Tree::moveForwardPlaceVertex},
+		{"g", &Tree::moveForward},
+		{"[", &Tree::pushState},
+		{"]", &Tree::popState},
+		{"{", &Tree::beginPoly},
+		{"}", &Tree::endPoly},
+		{"+", &Tree::turnLeft},
+		{"-", &Tree::turnRight},
+		{"^", &Tree::pitchUp},
+		{"&", &Tree::pitchDown},
+		{"\\", &Tree::rollLeft},
+		{"/", &Tree::rollRight},
+		{"|", &Tree::turnAround},
+		{"\xE2\x80\x99", &Tree::increaseColourIndex},
+		{";", &Tree::decreaseColourIndex},
+		{"#", &Tree::increaseLineWidth},
+		{"!", &Tree::decreaseLineWidth},
+		{".", &Tree::placeVertex}
 	};
 
+	for(const pair<string, RenderFunction>& command : commands) {
+		lsys::Token token;
+		if(alphabet.find(command.first, token)) {
+			functionTable[token] = command.second;
+		}
+	}
+
+	// Interpreting the string only builds the mesh buffers, so trees
+	// can be built on any thread. The display list is created later
+	// by upload, on the thread that owns the GL context.
+	createFromString(expansion);
+}
+
+void Tree::upload() {
 	createDisplayList();
+
+	// Polygons are only needed to build the display list
+	polygons.clear();
+	polygons.shrink_to_fit();
 }
 
 void Tree::createDisplayList() {
 	displayList = glGenLists(1);
 	glNewList(displayList, GL_COMPILE);
 
-	glRotatef(-90, 1, 0, 0);
+	emitPolygons();
 
-	createFromString();
+	// Every branch segment has been accumulated into the
+	// triangle list, so emit the whole mesh in one batch
+	emitBranchMesh(buildBranchBatch());
 	
 	glEndList();
 }
 
-void Tree::createFromString() {
-	string s = strings.back();
+void Tree::emitPolygons() {
+	tMaterial();
+
+	int colourIndex = -1;
+	for(const TreePolygon& tp : polygons) {
+		if(tp.colourIndex != colourIndex) {
+			colourIndex = tp.colourIndex;
+			if(colourIndex < 0) {
+				tMaterial();
+			} else {
+				setMaterial(colours[colourIndex]);
+			}
+		}
 
-	for(int i = 0; i < int(s.size()); i++) {
-		char c = s.at(i);
+		glBegin(GL_POLYGON);
+		for(vec3 v : tp.vertices) {
+			glVertex3f(v.x, v.y, v.z);
+		}
+		glEnd();
+	}
+}
+
+void Tree::emitBranchMesh(const BranchBatch& batch) {
+	tMaterial();
+
+	// The arrays are copied into the display list when it is compiled,
+	// so the batch doesn't need to outlive this call
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, batch.vertices.data());
+	glNormalPointer(GL_FLOAT, 0, batch.normals.data());
+	glDrawArrays(GL_TRIANGLES, 0, batch.getVertexCount());
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void Tree::createFromString(lsys::Expansion& expansion) {
+	// Symbols are consumed as the expansion produces them, so
+	// the final string never has to be held in memory
+	char c;
+	while(expansion.next(c)) {
 		// Get the corresponding function for character
 		// c and call it on this object
-		if(functionMap.find(c) != functionMap.end()) {
-			RenderFunction func = functionMap.at(c);
+		RenderFunction func = functionTable[(unsigned char)c];
+		if(func != nullptr) {
 			(this->*func)();
 		}
 	}
 }
 
 void Tree::render() {
+	render(vec3(0, 0, 0), 0.0, 1.0);
+}
+
+void Tree::render(vec3 position, float rotation, float scale) {
 	glPushMatrix();
+		// Trees are built with z up, so stand them upright first
+		glRotatef(-90, 1, 0, 0);
+		glTranslatef(position.x, position.y, position.z);
+		glRotatef(rotation, 0, 0, 1);
+		glScalef(scale, scale, scale);
 		glCallList(displayList);
 	glPopMatrix();
 }
 
-void Tree::turnPointsToTriangles(vec3 posStart, vec3 posEnd) {
-	float radiusEnd = max(state.radiusStart - state.radiusDecay, 0.1f);
-
-	vec3 topLeft = vec3(posEnd.x - radiusEnd, posEnd.y, posEnd.z);
-	vec3 topRight = vec3(posEnd.x, posEnd.y + radiusEnd, posEnd.z);
-	vec3 botLeft = vec3(posStart.x - state.radiusStart, posStart.y, posStart.z);
-	vec3 botRight = vec3(posStart.x, posStart.y + state.radiusStart, posStart.z);
+int Tree::placeRing(vec3 centre, float radius) {
+	// The ring lies across the turtle's heading, so branches stay
+	// round whichever way they point
+	vec3 l = state.left();
+	vec3 u = state.up();
 
-	makeTriangle(topLeft, topRight, botRight);
-	makeTriangle(botRight, botLeft, topLeft);
-
-	topLeft = topRight;
-	topRight = vec3(posEnd.x + radiusEnd, posEnd.y, posEnd.z);
-	botLeft = botRight;
-	botRight = vec3(posStart.x + state.radiusStart, posStart.y, posStart.z);
-
-	makeTriangle(topLeft, topRight, botRight);
-	makeTriangle(botRight, botLeft, topLeft);
-
-	topLeft = topRight;
-	topRight = vec3(posEnd.x, posEnd.y - radiusEnd, posEnd.z);
-	botLeft = botRight;
-	botRight = vec3(posStart.x, posStart.y - state.radiusStart, posStart.z);
-
-	makeTriangle(topLeft, topRight, botRight);
-	makeTriangle(botRight, botLeft, topLeft);
-
-	topLeft = topRight;
-	topRight = vec3(posEnd.x - radiusEnd, posEnd.y, posEnd.z);
-	botLeft = botRight;
-	botRight = vec3(posStart.x - state.radiusStart, posStart.y, posStart.z);
-
-	makeTriangle(topLeft, topRight, botRight);
-	makeTriangle(botRight, botLeft, topLeft);
-
-	state.radiusStart = radiusEnd;
+	int first = int(mesh->vertices.size());
+	for(const vec2& offset : ringOffsets) {
+		vec3 n = l * offset.x + u * offset.y;
+		mesh->vertices.push_back(centre + n * radius);
+		mesh->normals.push_back(n);
+	}
+	return first;
 }
 
-void Tree::makeTriangle(vec3 first, vec3 second, vec3 third) {
-	vertices.push_back(first);
-	vertices.push_back(second);
-	vertices.push_back(third);
+void Tree::connectRings(int bottom, int top) {
+	int n = int(ringOffsets.size());
+	for(int i = 0; i < n; i++) {
+		int next = (i + 1) % n;
+		mesh->triangles.push_back(Triangle(bottom + i, bottom + next, top + next));
+		mesh->triangles.push_back(Triangle(top + next, top + i, bottom + i));
+	}
+}
 
-	vec3 v = second - first;
-	vec3 w = third - first;
+const vector<vec3>& Tree::getBranchVertices() const {
+	return mesh->vertices;
+}
 
-	vec3 faceNormal = cross(v, w);
+shared_ptr<const Mesh> Tree::getBranchMesh() const {
+	return mesh;
+}
 
-	normals.push_back(faceNormal);
-	Triangle t = Triangle(vertices.size()-3, vertices.size()-2, vertices.size()-1);
-	for(int i = 0; i < 3; i++) {
-		t.normals.push_back(normals.size() - 1);
-	}
-	triangles.push_back(t);
+int Tree::getTriangleCount() const {
+	return int(mesh->triangles.size());
 }
 
-std::vector<cgra::vec3> Tree::getBranchVertices() {
-	return vertices;
+// Needs no GL context, so the batch a tree would upload can be
+// inspected headlessly
+BranchBatch Tree::buildBranchBatch() const {
+	BranchBatch batch;
+	batch.vertices.reserve(mesh->triangles.size() * 9);
+	batch.normals.reserve(mesh->triangles.size() * 9);
+	for(const Triangle& t : mesh->triangles) {
+		for(int j = 0; j < 3; j++) {
+			vec3 v = mesh->vertices[t.vertices[j]];
+			vec3 n = mesh->normals[t.vertices[j]];
+			batch.vertices.insert(batch.vertices.end(), { v.x, v.y, v.z });
+			batch.normals.insert(batch.normals.end(), { n.x, n.y, n.z });
+		}
+	}
+	return batch;
 }
 
 void Tree::drawBranchPlaceVertex() {
@@ -214,32 +281,22 @@ void Tree::drawBranchPlaceVertex() {
 
 void Tree::drawBranch() {
 	vec3 posStart = state.position;
-	vec3 move = state.heading() * state.length;
-
-	vec3 posEnd = translate(posStart, move);
+	vec3 posEnd = posStart + state.heading() * state.length;
 	state.position = posEnd;
 
-	turnPointsToTriangles(posStart, posEnd);
-
-	tMaterial();
-	glBegin(GL_TRIANGLES);
-	for(int i = 0; i < int(triangles.size()); i++) {
-		Triangle t = triangles[i];
-		vec3 n1 = normals[t.normals[0]];
-		vec3 n2 = normals[t.normals[1]];
-		vec3 n3 = normals[t.normals[2]];
-		glNormal3f(n1.x, n1.y, n1.z);
-		glNormal3f(n2.x, n2.y, n2.z);
-		glNormal3f(n3.x, n3.y, n3.z);
-
-		vec3 v1 = vertices[t.vertices[0]];
-		vec3 v2 = vertices[t.vertices[1]];
-		vec3 v3 = vertices[t.vertices[2]];
-		glVertex3f(v1.x, v1.y, v1.z);
-		glVertex3f(v2.x, v2.y, v2.z);
-		glVertex3f(v3.x, v3.y, v3.z);
+	// Carry on from the ring the last branch ended with, so that
+	// consecutive segments form one continuous cylinder
+	int bottom = state.ring;
+	if(bottom < 0) {
+		bottom = placeRing(posStart, state.radiusStart);
 	}
-	glEnd();
+
+	float radiusEnd = max(state.radiusStart - state.radiusDecay, 0.1f);
+	int top = placeRing(posEnd, radiusEnd);
+	connectRings(bottom, top);
+
+	state.radiusStart = radiusEnd;
+	state.ring = top;
 }
 
 void Tree::moveForwardPlaceVertex() {
@@ -248,10 +305,8 @@ void Tree::moveForwardPlaceVertex() {
 }
 
 void Tree::moveForward() {
-	vec3 posStart = state.position;
-	vec3 move = state.heading() * state.length;
-	vec3 posEnd = translate(posStart, move);
-	state.position = posEnd;
+	state.position += state.heading() * state.length;
+	state.ring = -1;
 }
 
 void Tree::placeVertex() {
@@ -262,48 +317,41 @@ void Tree::placeVertex() {
 }
 
 void Tree::turnLeft() {
-	mat4 re = rotate(state.orientation, up, state.angle);
-	state.orientation = re;
+	state.turn(turnLeftRotation);
 }
 
 void Tree::turnRight() {
-	mat4 re = rotate(state.orientation, up, -state.angle);
-	state.orientation = re;
+	state.turn(turnRightRotation);
 }
 
 void Tree::pitchUp() {
-	mat4 re = rotate(state.orientation, left, state.angle);
-	state.orientation = re;
+	state.turn(pitchUpRotation);
 }
 
 void Tree::pitchDown() {
-	mat4 re = rotate(state.orientation, left, -state.angle);
-	state.orientation = re;
+	state.turn(pitchDownRotation);
 }
 
 void Tree::rollLeft() {
-	mat4 re = rotate(state.orientation, heading, state.angle);
-	state.orientation = re;
+	state.turn(rollLeftRotation);
 }
 
 void Tree::rollRight() {
-	mat4 re = rotate(state.orientation, heading, -state.angle);
-	state.orientation = re;
+	state.turn(rollRightRotation);
 }
 
 void Tree::turnAround() {
 	// Flips 180 degrees
-	mat4 re = rotate(state.orientation, up, 180.0);
-	state.orientation = re;
+	state.turn(turnAroundRotation);
 }
 
 void Tree::pushState() {
-	stateStack.push(state);
+	stateStack.push_back(state);
 }
 
 void Tree::popState() {
-	state = stateStack.top();
-	stateStack.pop();
+	state = stateStack.back();
+	stateStack.pop_back();
 }
 
 void Tree::beginPoly() {
@@ -315,35 +363,40 @@ void Tree::endPoly() {
 	TreePolygon* tp = polygonStack.top();
 	polygonStack.pop();
 
-	glBegin(GL_POLYGON);
-	for(vec3 v : tp->vertices) {
-		glVertex3f(v.x, v.y, v.z);
-	}
-	glEnd();
+	tp->colourIndex = currentColour;
+	polygons.push_back(move(*tp));
 
 	delete tp;
 }
 
 void Tree::increaseColourIndex() {
+	if(colours.empty()) {
+		return;
+	}
+
 	int newColourIndex = state.colourIndex + 1;
-	if(newColourIndex < int(state.colours.size())) {
+	if(newColourIndex < int(colours.size())) {
 		state.colourIndex = newColourIndex;
 	} else {
 		state.colourIndex = 0;
 	}
 
-	setMaterial(state.colours[state.colourIndex]);
+	currentColour = state.colourIndex;
 }
 
 void Tree::decreaseColourIndex() {
+	if(colours.empty()) {
+		return;
+	}
+
 	int newColourIndex = state.colourIndex - 1;
 	if(newColourIndex >= 0) {
 		state.colourIndex = newColourIndex;
 	} else {
-		state.colourIndex = int(state.colours.size()-1);
+		state.colourIndex = int(colours.size()-1);
 	}
 
-	setMaterial(state.colours[state.colourIndex]);
+	currentColour = state.colourIndex;
 }
 
 void Tree::increaseLineWidth() {
@@ -1,10 +1,13 @@
 #pragma once
 
-#include <map>
+#include <memory>
 #include <stack>
+#include <vector>
 
 #include "opengl.hpp"
 #include "cgra_math.hpp"
+#include "lsystem.hpp"
+#include "mesh.hpp"
 #include "triangle.hpp"
 
 namespace tree {
@@ -13,57 +16,58 @@ namespace tree {
 	const cgra::vec3 left = cgra::vec3(1, 0, 0);
 	const cgra::vec3 heading = cgra::vec3(0, 0, 1);
 
+	// Turtle state saved and restored by [ and ]. It is plain
+	// data, so pushing a branch is a flat copy.
 	struct TreeState {
 		float angle;
 		float length;
 		float radiusDecay = 0.05;
 		float radiusStart = 0.4;
 		int colourIndex = 0;
-		cgra::mat4 orientation = cgra::mat4(
-			cgra::vec4(1, 0, 0, 0),
-			cgra::vec4(0, 1, 0, 0),
-			cgra::vec4(0, 0, 1, 0),
-			cgra::vec4(0, 0, 0, 1)
-		);
+
+		// The turtle's left, up and heading directions in tree space,
+		// stored as the columns of a rotation matrix
+		cgra::mat3 orientation = cgra::mat3(1);
+
+		// Turns applied since the frame was last re-orthonormalised
+		int turns = 0;
+
+		// First vertex of the ring at the end of the last branch
+		// drawn, which the next branch starts from, or -1 if the
+		// turtle has since moved off it
+		int ring = -1;
+
 		cgra::vec3 position;
-		std::vector<cgra::vec3> colours;
 
-		cgra::vec3 up() {
-			cgra::vec4 u = cgra::vec4(0, 1, 0, 1);
-			cgra::vec4 i = cgra::vec4(
-				dot(orientation[0], u),
-				dot(orientation[1], u),
-				dot(orientation[2], u),
-				dot(orientation[3], u)
-			);
-			return cgra::vec3(i.x, i.y, i.z);
+		cgra::vec3 left() {
+			return orientation[0];
 		}
 
-		cgra::vec3 left() {
-			cgra::vec4 l = cgra::vec4(1, 0, 0, 1);
-			cgra::vec4 i = cgra::vec4(
-				dot(orientation[0], l),
-				dot(orientation[1], l),
-				dot(orientation[2], l),
-				dot(orientation[3], l)
-			);
-			return cgra::vec3(i.x, i.y, i.z);
+		cgra::vec3 up() {
+			return orientation[1];
 		}
 
 		cgra::vec3 heading() {
-			cgra::vec4 h = cgra::vec4(0, 0, 1, 1);
-			cgra::vec4 i = cgra::vec4(
-				dot(orientation[0], h),
-				dot(orientation[1], h),
-				dot(orientation[2], h),
-				dot(orientation[3], h)
-			);
-			return cgra::vec3(i.x, i.y, i.z);
+			return orientation[2];
+		}
+
+		void turn(const cgra::mat3&);
+	};
+
+	// The branch mesh unindexed, in the order it is sent to GL: three
+	// vertices per triangle, with x, y and z packed one after another
+	struct BranchBatch {
+		std::vector<float> vertices;
+		std::vector<float> normals;
+
+		int getVertexCount() const {
+			return int(vertices.size() / 3);
 		}
 	};
 
 	struct TreePolygon {
 		std::vector<cgra::vec3> vertices;
+		int colourIndex = -1;
 	};
 
 	// Forward declare Tree so that pointers to 
@@ -75,18 +79,46 @@ namespace tree {
 	class Tree {
 	private:
 		
-		std::vector<std::string> strings;
 
 		TreeState state;
-		std::stack<TreeState> stateStack;
+		std::vector<TreeState> stateStack;
 		std::stack<TreePolygon*> polygonStack;
-		std::map<char, RenderFunction> functionMap;
-		std::vector<cgra::vec3> vertices;
-		std::vector<cgra::vec3> normals;
-		std::vector<Triangle> triangles;
+
+		// Turtle command for each token, or nullptr if the token
+		// does not move the turtle. Indexed by the token byte so
+		// dispatch is a single load rather than a map lookup.
+		RenderFunction functionTable[256] = {};
+
+		// Branch mesh, kept after upload so it can be shared with
+		// anything else that needs the tree's geometry
+		std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+		std::vector<TreePolygon> polygons;
+
+		// Palette entry that finished polygons are drawn with, or -1
+		// for the default material. Like the GL material it stands in
+		// for, it is not restored when the turtle state is popped.
+		int currentColour = -1;
 
 		GLuint displayList = 0;
 
+		// Palette that the turtle's colour index selects from. It
+		// is the same for the whole tree, so it is kept here rather
+		// than in TreeState where every push would copy it.
+		std::vector<cgra::vec3> colours;
+
+		// Unit circle offsets for the vertices of each branch ring
+		std::vector<cgra::vec2> ringOffsets;
+
+		// The branch angle is fixed for a tree, so the rotation for
+		// each turn command is worked out once up front
+		cgra::mat3 turnLeftRotation;
+		cgra::mat3 turnRightRotation;
+		cgra::mat3 pitchUpRotation;
+		cgra::mat3 pitchDownRotation;
+		cgra::mat3 rollLeftRotation;
+		cgra::mat3 rollRightRotation;
+		cgra::mat3 turnAroundRotation;
+
 		void drawBranchPlaceVertex();
 		void drawBranch();
 		void drawLeaf();
@@ -109,14 +141,34 @@ namespace tree {
 		void increaseLineWidth();
 		void decreaseLineWidth();
 
-		void createFromString();
+		void createFromString(lsys::Expansion&);
 		void createDisplayList();
-		void turnPointsToTriangles(cgra::vec3, cgra::vec3);
-		void makeTriangle(cgra::vec3, cgra::vec3, cgra::vec3);
+		void emitPolygons();
+		void emitBranchMesh(const BranchBatch&);
+		int placeRing(cgra::vec3, float);
+		void connectRings(int, int);
 	public:
 		Tree();
-		Tree(cgra::vec3, std::vector<std::string>, float, float, std::vector<cgra::vec3>);
+		Tree(lsys::Expansion&, float, float, std::vector<cgra::vec3>, int, const lsys::Alphabet&);
+		void upload();
 		void render();
-		std::vector<cgra::vec3> getBranchVertices();
+		void render(cgra::vec3, float, float);
+		const std::vector<cgra::vec3>& getBranchVertices() const;
+		std::shared_ptr<const Mesh> getBranchMesh() const;
+		int getTriangleCount() const;
+		BranchBatch buildBranchBatch() const;
+	};
+
+	// A placement of a shared tree mesh. Many instances can refer to
+	// the same Tree, which is compiled to a display list only once.
+	struct TreeInstance {
+		Tree* tree = nullptr;
+		cgra::vec3 position;
+		float rotation = 0.0;
+		float scale = 1.0;
+
+		void render() {
+			tree->render(position, rotation, scale);
+		}
 	};
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <cstdint>
+#include <cstring>
 #include <iostream> // input/output streams
 #include <fstream>  // file streams
 #include <sstream>  // string streams
@@ -7,6 +9,8 @@
 
 #include "cgra_math.hpp"
 #include "lsystem.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
 #include "tree.hpp"
 #include "treefactory.hpp"
 
@@ -15,21 +19,154 @@ using namespace lsys;
 using namespace std;
 using namespace tree;
 
-TreeGenerator::TreeGenerator() {}
+// Compiled species files start with this magic and a version number,
+// followed by the alphabet and each generator's parameters and rules.
+// Values are written in native byte order.
+static const char speciesMagic[4] = { 'F', 'S', 'S', 'P' };
+static const uint32_t speciesVersion = 2;
+
+// Cursor over an in-memory compiled species file
+struct SpeciesReader {
+	const std::vector<char>& data;
+	size_t offset;
+
+	SpeciesReader(const std::vector<char>& d) : data(d), offset(0) {}
 
-Tree* TreeGenerator::generate(vec3 startingPos) {
-	vector<string> s;
-	for(int i = 0; i < generations; i++) {
-		s = lsystem.generate();
+	void read(void* out, size_t size) {
+		if(offset + size > data.size()) {
+			throw runtime_error("Error :: compiled species file is truncated.");
+		}
+		memcpy(out, data.data() + offset, size);
+		offset += size;
+	}
+
+	template <typename T> T value() {
+		T v;
+		read(&v, sizeof(T));
+		return v;
+	}
+
+	string text() {
+		uint32_t size = value<uint32_t>();
+		if(offset + size > data.size()) {
+			throw runtime_error("Error :: compiled species file is truncated.");
+		}
+		string s(data.data() + offset, size);
+		offset += size;
+		return s;
 	}
+};
+
+template <typename T> static void writeValue(ostream& out, T v) {
+	out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+static void writeText(ostream& out, const string& s) {
+	writeValue<uint32_t>(out, uint32_t(s.size()));
+	out.write(s.data(), s.size());
+}
+
+TreeGenerator::TreeGenerator() {}
+
+Tree* TreeGenerator::generate(const Alphabet& alphabet, rng::Generator& random) const {
+	Expansion expansion(lsystem, int(generations), random.split(0));
 	
-	float sl = math::random(startLength[0], startLength[1]);
+	float sl = random.uniform(startLength[0], startLength[1]);
+
+	// Jitter the palette so variants of a species are not all
+	// exactly the same shade
+	vector<vec3> variantColours = colours;
+	for(vec3& c : variantColours) {
+		c = clamp(c * random.uniform(0.85f, 1.15f), 0.0f, 1.0f);
+	}
+
+	return new Tree(expansion, branchAngle, sl, variantColours, ringResolution, alphabet);
+}
+
+TreeFactory::TreeFactory() {
+	variantsPerSpecies = 0;
+}
+
+TreeFactory::TreeFactory(string filename, int variantCount, rng::Generator r) {
+	variantsPerSpecies = variantCount;
+	random = r;
+	load(filename);
+	generateVariants();
+}
+
+void TreeFactory::compile(string source, string destination) {
+	TreeFactory factory;
+	factory.load(source);
+	factory.writeBinary(destination);
+}
+
+vector<TreeGenerator> TreeFactory::readSpecies(string filename, Alphabet& alphabet) {
+	TreeFactory factory;
+	factory.load(filename);
+	alphabet = factory.alphabet;
+	return factory.generators;
+}
+
+// Loads either a text species file or one compiled by TreeFactory::compile
+void TreeFactory::load(string filename) {
+	ifstream file(filename, ios::binary);
+
+	if(!file.is_open()) {
+		cerr << "Error reading " << filename << endl;
+		throw runtime_error("Error :: could not open file.");
+	}
+
+	// Compiled files are read with a single bulk read and
+	// decoded from memory
+	char magic[4] = { 0, 0, 0, 0 };
+	file.read(magic, 4);
+	if(file.gcount() == 4 && memcmp(magic, speciesMagic, 4) == 0) {
+		file.seekg(0, ios::end);
+		vector<char> data(size_t(file.tellg()));
+		file.seekg(0, ios::beg);
+		file.read(data.data(), data.size());
+		readBinary(data);
+	} else {
+		file.close();
+		readFile(filename);
+	}
+}
 
-	return new Tree(startingPos, s, branchAngle, sl, colours);
+TreeFactory::~TreeFactory() {
+	for(vector<Tree*>& species : variants) {
+		for(Tree* t : species) {
+			delete t;
+		}
+	}
 }
 
-TreeFactory::TreeFactory(string filename) {
-	readFile(filename);
+void TreeFactory::generateVariants() {
+	variants.assign(generators.size(), vector<Tree*>(variantsPerSpecies, nullptr));
+
+	// Expand and interpret every variant on the worker pool. Each one
+	// draws from its own stream, so the result does not depend on how
+	// many threads there are.
+	ThreadPool::shared()->parallelFor(int(generators.size()) * variantsPerSpecies, [&](int job) {
+		int g = job / variantsPerSpecies;
+		int v = job % variantsPerSpecies;
+		rng::Generator variantRandom = random.split(job);
+		variants[g][v] = generators[g].generate(alphabet, variantRandom);
+	});
+
+	// Display lists can only be compiled on the GL thread
+	for(vector<Tree*>& species : variants) {
+		for(Tree* t : species) {
+			t->upload();
+		}
+	}
+
+	// Report how much of each species' expansion was reused from the
+	// L-system's subtree cache
+	for(int g = 0; g < int(generators.size()); g++) {
+		const string& name = generators[g].name;
+		cout << "Species " << g << (name.empty() ? "" : " " + name) << ", ";
+		generators[g].lsystem.getStats().print();
+	}
 }
 
 void TreeFactory::readFile(string filename) {
@@ -70,7 +207,7 @@ void TreeFactory::readFile(string filename) {
 		} else if(key == "name") {
 			t.name = values[0];
 		} else if(key == "axiom") {
-			t.axiom = values[0];
+			t.axiom = alphabet.encode(values[0]);
 		} else if(key == "startLength") {
 			float lower = stof(values[0]);
 			float upper = stof(values[1]);
@@ -82,6 +219,8 @@ void TreeFactory::readFile(string filename) {
 			t.probability = stof(values[0]);
 		} else if(key == "generations") {
 			t.generations = stof(values[0]);
+		} else if(key == "ringResolution") {
+			t.ringResolution = stoi(values[0]);
 		} else if(key == "colours") {
 			for(int rIndex = 0; rIndex < int(values.size()); rIndex += 3) {
 				int gIndex = rIndex + 1;
@@ -96,15 +235,15 @@ void TreeFactory::readFile(string filename) {
 		} else if(key == "rulestart") {
 			// rules.clear();
 		} else if(key == "match") {
-			match = values[0][0];
+			match = alphabet.encode(values[0])[0];
 		} else if(key == "transform") {
-			transform = values[0];
+			transform = alphabet.encode(values[0]);
 		} else if(key == "rulechance") {
 			rulechance = stof(values[0]);
 		} else if(key == "rightcontext") {
-			rightcontext = values[0];
+			rightcontext = alphabet.encode(values[0]);
 		} else if(key == "leftcontext") {
-			leftcontext = values[0];
+			leftcontext = alphabet.encode(values[0]);
 		} else if(key == "ruleend") {
 			Rule r;
 			if(rulechance != 0.0 && (rightcontext != "Z" || leftcontext != "Z")) {
@@ -137,8 +276,112 @@ void TreeFactory::readFile(string filename) {
 	}
 }
 
-Tree* TreeFactory::generate(vec3 startingPos) {
-	int rand = math::random(0, int(generators.size()));
-	TreeGenerator tg = generators[rand];
-	return tg.generate(startingPos);
+void TreeFactory::readBinary(const vector<char>& data) {
+	SpeciesReader in(data);
+
+	char magic[4];
+	in.read(magic, 4);
+	uint32_t version = in.value<uint32_t>();
+	if(memcmp(magic, speciesMagic, 4) != 0 || version != speciesVersion) {
+		throw runtime_error("Error :: unsupported compiled species file version.");
+	}
+
+	// Interning in token order reproduces the original tokens
+	uint32_t symbolCount = in.value<uint32_t>();
+	for(uint32_t i = 0; i < symbolCount; i++) {
+		alphabet.intern(in.text());
+	}
+
+	uint32_t generatorCount = in.value<uint32_t>();
+	for(uint32_t g = 0; g < generatorCount; g++) {
+		TreeGenerator t;
+		t.name = in.text();
+		t.axiom = in.text();
+		float lower = in.value<float>();
+		float upper = in.value<float>();
+		t.startLength.push_back(lower);
+		t.startLength.push_back(upper);
+		t.branchAngle = in.value<float>();
+		t.probability = in.value<float>();
+		t.generations = in.value<float>();
+		t.ringResolution = in.value<int32_t>();
+
+		uint32_t colourCount = in.value<uint32_t>();
+		for(uint32_t c = 0; c < colourCount; c++) {
+			float r = in.value<float>();
+			float gr = in.value<float>();
+			float b = in.value<float>();
+			t.colours.push_back(vec3(r, gr, b));
+		}
+
+		uint32_t ruleCount = in.value<uint32_t>();
+		for(uint32_t r = 0; r < ruleCount; r++) {
+			char match = in.value<char>();
+			string transform = in.text();
+			RuleContext rc;
+			rc.left = in.text();
+			rc.right = in.text();
+			float chance = in.value<float>();
+			t.rules.push_back(Rule(match, transform, rc, chance));
+		}
+
+		t.lsystem = LSystem(t.axiom, t.rules);
+		generators.push_back(t);
+	}
+}
+
+void TreeFactory::writeBinary(string filename) {
+	ofstream out(filename, ios::binary);
+
+	if(!out.is_open()) {
+		cerr << "Error writing " << filename << endl;
+		throw runtime_error("Error :: could not open file.");
+	}
+
+	out.write(speciesMagic, 4);
+	writeValue<uint32_t>(out, speciesVersion);
+
+	writeValue<uint32_t>(out, uint32_t(alphabet.getTokenCount() - 128));
+	for(int token = 128; token < alphabet.getTokenCount(); token++) {
+		writeText(out, alphabet.getSymbol(Token(token)));
+	}
+
+	writeValue<uint32_t>(out, uint32_t(generators.size()));
+	for(const TreeGenerator& t : generators) {
+		writeText(out, t.name);
+		writeText(out, t.axiom);
+		writeValue<float>(out, t.startLength[0]);
+		writeValue<float>(out, t.startLength[1]);
+		writeValue<float>(out, t.branchAngle);
+		writeValue<float>(out, t.probability);
+		writeValue<float>(out, t.generations);
+		writeValue<int32_t>(out, int32_t(t.ringResolution));
+
+		writeValue<uint32_t>(out, uint32_t(t.colours.size()));
+		for(const vec3& c : t.colours) {
+			writeValue<float>(out, c.x);
+			writeValue<float>(out, c.y);
+			writeValue<float>(out, c.z);
+		}
+
+		writeValue<uint32_t>(out, uint32_t(t.rules.size()));
+		for(const Rule& r : t.rules) {
+			writeValue<char>(out, r.getCharacter());
+			writeText(out, r.transform);
+			writeText(out, r.getContext().left);
+			writeText(out, r.getContext().right);
+			writeValue<float>(out, r.chance);
+		}
+	}
+}
+
+TreeInstance TreeFactory::generate(vec3 startingPos, rng::Generator& r) const {
+	const vector<Tree*>& species = variants[r.below(int(variants.size()))];
+
+	TreeInstance instance;
+	instance.tree = species[r.below(int(species.size()))];
+	instance.position = startingPos;
+	instance.rotation = r.uniform(0.0f, 360.0f);
+	instance.scale = r.uniform(0.85f, 1.15f);
+	return instance;
 }
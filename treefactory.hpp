@@ -5,6 +5,7 @@
 
 #include "cgra_math.hpp"
 #include "lsystem.hpp"
+#include "rng.hpp"
 #include "tree.hpp"
 
 namespace tree {
@@ -12,23 +13,44 @@ namespace tree {
 		std::string name;
 		std::string axiom;
 		std::vector<float> startLength;
-		float branchAngle;
-		float probability;
-		float generations;
+		float branchAngle = 0.0;
+		float probability = 0.0;
+		float generations = 0.0;
+		int ringResolution = 6;
 		std::vector<cgra::vec3> colours;
 
 		lsys::LSystem lsystem;
 		std::vector<lsys::Rule> rules;
 		TreeGenerator();
-		Tree* generate(cgra::vec3);
+		Tree* generate(const lsys::Alphabet&, rng::Generator&) const;
 	};
 
 	class TreeFactory {
 	private:
+		lsys::Alphabet alphabet;
 		std::vector<TreeGenerator> generators;
+
+		// Meshes shared by every instance of a species, indexed
+		// by generator then variant
+		int variantsPerSpecies;
+		std::vector<std::vector<Tree*>> variants;
+		rng::Generator random;
+
+		TreeFactory();
+		void load(std::string);
 		void readFile(std::string);
+		void readBinary(const std::vector<char>&);
+		void writeBinary(std::string);
+		void generateVariants();
 	public:
-		TreeFactory(std::string);
-		Tree* generate(cgra::vec3);
+		TreeFactory(std::string, int, rng::Generator);
+		~TreeFactory();
+		TreeInstance generate(cgra::vec3, rng::Generator&) const;
+
+		static void compile(std::string, std::string);
+
+		// Reads the species in a text or compiled file without building
+		// any trees, for tools that only need the rules
+		static std::vector<TreeGenerator> readSpecies(std::string, lsys::Alphabet&);
 	};
 }
\ No newline at end of file
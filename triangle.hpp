@@ -1,17 +1,16 @@
 #pragma once
 
-#include <vector>
-
-#include "cgra_math.hpp"
+#include <cstdint>
 
+// Three indices into a mesh's vertex list. Normals are stored per
+// vertex by the owning mesh, so a triangle is plain data and a list
+// of them is one contiguous index buffer.
 struct Triangle {
-	cgra::vec3 normal;
-	std::vector<int> vertices;
-	std::vector<int> normals;
+	uint32_t vertices[3];
 	Triangle() {};
-	Triangle(int v1, int v2, int v3) {
-		vertices.push_back(v1);
-		vertices.push_back(v2);
-		vertices.push_back(v3);
+	Triangle(uint32_t v1, uint32_t v2, uint32_t v3) {
+		vertices[0] = v1;
+		vertices[1] = v2;
+		vertices[2] = v3;
 	};
-};
\ No newline at end of file
+};